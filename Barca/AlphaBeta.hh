@@ -3,16 +3,26 @@
  #define H_ALPHABETA
 
 #include <stddef.h>
+#include <stdint.h>
 #include <assert.h>
-#include <queue>
+#include <sys/time.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
 #include <vector>
+#include "TranspositionTable.hh"
 
 
-template<typename State        // a state of the world, not necessarily including whose turn it is
-        ,typename Move         // an indication of how to get from one state to another state
-        ,typename Value        // a scalar "goodness" measure (e.g., "int" or "double")
-         >
-class AlphaBeta {
+/* The functions through which AlphaBeta sees the game, as pointers
+ * supplied at run time. This is the default Hooks class of AlphaBeta,
+ * which fills it in from the pointers passed to its constructor; any
+ * of the optional ones may be NULL. */
+template<typename State, typename Move, typename Value, typename Undo>
+struct FunctionPointerHooks {
     // Given a State, return an approximation of its Value to the defender.
     // (Its value to the attacker is just the negation of this value.)
     // A State which the defender is happy to defend will have a high Value.
@@ -23,6 +33,12 @@ class AlphaBeta {
     typedef Value (*Evaluator)(const State &st);
     // Given a State, apply the given Move to produce a new State.
     typedef void (*MoveApplier)(State &st, const Move &move);
+    // Alternatively, given a State, apply the given Move to it in place,
+    // filling in "undo" with whatever unmakemove() will need to take the
+    // Move back again. This lets the depth-first searches work on a single
+    // State, rather than copying the whole State at every node.
+    typedef void (*MoveMaker)(State &st, const Move &move, Undo &undo);
+    typedef void (*MoveUnmaker)(State &st, const Move &move, const Undo &undo);
     // Given a State, find all moves available to the attacker and add them
     // to the given vector (which will be initially empty).
     typedef void (*MoveFinder)(const State &st, std::vector<Move> &allmoves);
@@ -31,26 +47,472 @@ class AlphaBeta {
     // each time applymove() is called, and findattacker() will just return
     // that field.
     typedef int (*AttackerFinder)(const State &st);
+    // Given a State, return a 64-bit hash of it (including whose turn it
+    // is), for use as a transposition-table key. Two states with the same
+    // hash are assumed to be the same state.
+    typedef uint64_t (*Hasher)(const State &st);
+    // Given a State and one of its moves, return zero if the move is
+    // "quiet", or a positive number if it's a forcing or tactical move
+    // that deserves to be searched early (the bigger, the earlier).
+    typedef int (*MoveClassifier)(const State &st, const Move &move);
+    // Given a Move, return a small integer (e.g., from*N+to) identifying
+    // it for the history heuristic; the same Move played from different
+    // States should get the same index.
+    typedef int (*MoveIndexer)(const Move &move);
+
+    Evaluator evaluate;
+    MoveApplier applymove;
+    MoveMaker makemove;
+    MoveUnmaker unmakemove;
+    MoveFinder findmoves;
+    AttackerFinder findattacker;
+    Hasher findhash;
+    MoveClassifier classifymove;
+    MoveIndexer indexmove;
+
+    FunctionPointerHooks(Evaluator ev, MoveApplier app, MoveMaker mk, MoveUnmaker unmk,
+                         MoveFinder fm, AttackerFinder fa,
+                         Hasher fh, MoveClassifier mc, MoveIndexer mi):
+        evaluate(ev), applymove(app), makemove(mk), unmakemove(unmk),
+        findmoves(fm), findattacker(fa),
+        findhash(fh), classifymove(mc), indexmove(mi) { }
+
+    bool has_applymove() const { return applymove != NULL; }
+    bool has_makemove() const { return makemove != NULL; }
+    bool has_hash() const { return findhash != NULL; }
+    bool has_classifier() const { return classifymove != NULL; }
+    bool has_indexer() const { return indexmove != NULL; }
+
+    /* Null moves and batch evaluation (see AlphaBetaHooks) can only be
+     * supplied at compile time. */
+    bool has_nullmove() const { return false; }
+    bool makenullmove(State &, Undo &) const { assert(false); return false; }
+    void unmakenullmove(State &, const Undo &) const { assert(false); }
+    bool has_batch_evaluator() const { return false; }
+    void evaluatemoves(const State &, const Move *, int, Value *) const { assert(false); }
+};
+
+/* The same functions, supplied at compile time, so that they can be
+ * inlined into the search. A game derives its own Hooks class from this
+ * one, defines static member functions with the same names and
+ * signatures as the pointers in FunctionPointerHooks, and hides each
+ * has_xxx() below with one that returns true if it supplies xxx.
+ * evaluate(), findmoves() and findattacker() are required, as is either
+ * applymove() or makemove() and unmakemove(). */
+template<typename State, typename Move, typename Value, typename Undo>
+struct AlphaBetaHooks {
+    static bool has_applymove() { return false; }
+    static bool has_makemove() { return false; }
+    static bool has_hash() { return false; }
+    static bool has_classifier() { return false; }
+    static bool has_indexer() { return false; }
+
+    static void applymove(State &, const Move &) { assert(false); }
+    static void makemove(State &, const Move &, Undo &) { assert(false); }
+    static void unmakemove(State &, const Move &, const Undo &) { assert(false); }
+    static uint64_t findhash(const State &) { assert(false); return 0; }
+    static int classifymove(const State &, const Move &) { assert(false); return 0; }
+    static int indexmove(const Move &) { assert(false); return 0; }
+
+    /* Optionally, a game may let the attacker "pass", for null-move
+     * pruning: makenullmove() hands the turn to the other player without
+     * moving anything, filling in "undo" for unmakenullmove(); or, if
+     * passing here could give a misleading answer (e.g., because the
+     * attacker is forced to move something), it leaves "st" alone and
+     * returns false. */
+    static bool has_nullmove() { return false; }
+    static bool makenullmove(State &, Undo &) { assert(false); return false; }
+    static void unmakenullmove(State &, const Undo &) { assert(false); }
+
+    /* Optionally, a game may evaluate many positions at once, if that's
+     * quicker than one at a time: evaluatemoves() sets values[i] to the
+     * value, to the attacker in "st", of the position after moves[i], as
+     * evaluate2() would work it out --- what evaluate() of that position
+     * says if the turn passes to the other player, and its negation if
+     * the attacker moves again.
+     *   Only parallel_breadth_first() uses it, for its leaves. The
+     * depth-first searches don't: most of their frontier nodes cut off
+     * after a move or two, so evaluating all the siblings at once costs
+     * more than it saves. */
+    static bool has_batch_evaluator() { return false; }
+    static void evaluatemoves(const State &, const Move *, int, Value *) { assert(false); }
+};
+
+
+/* The time of day, in microseconds. */
+inline long now_usec()
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec * 1000000L + now.tv_usec;
+}
+
+/* Lets one thread tell a search running in another to give up. */
+class CancellationToken {
+  public:
+    CancellationToken(): flag(false) { }
+    void cancel() { flag = true; }
+    bool is_cancelled() const { return flag; }
+    const std::atomic<bool> *as_flag() const { return &flag; }
+  private:
+    std::atomic<bool> flag;
+};
+
+/* Lets one thread run a search in another thread a slice of time at a
+ * time, as if it were a coroutine. The search calls checkpoint() every
+ * so often; once its slice is used up, that blocks until the owner calls
+ * run_for() again. Only one of the two threads runs at any moment, so the
+ * owner may look at the search's results between slices without locking.
+ * Handing over costs a context switch, i.e., some microseconds. */
+class TimeSlicer {
+  public:
+    TimeSlicer(): slice_end(0), running(false), finished(false) { }
+
+    /* Called by the owner: let the search run for "usec" microseconds,
+     * and return once it has paused again or finished. */
+    void run_for(long usec) {
+        std::unique_lock<std::mutex> lk(lock);
+        if (finished) return;
+        slice_end = now_usec() + usec;
+        running = true;
+        wakeup.notify_all();
+        wakeup.wait(lk, [this]() { return !running; });
+    }
+    bool is_finished() {
+        std::lock_guard<std::mutex> lk(lock);
+        return finished;
+    }
+
+    /* Called by the search: pause here if the slice is used up. */
+    void checkpoint() {
+        if (now_usec() < slice_end.load(std::memory_order_relaxed))
+          return;
+        std::unique_lock<std::mutex> lk(lock);
+        running = false;
+        wakeup.notify_all();
+        wakeup.wait(lk, [this]() { return running; });
+    }
+    /* Called by the search when it's done, instead of pausing. */
+    void finish() {
+        std::lock_guard<std::mutex> lk(lock);
+        finished = true;
+        running = false;
+        wakeup.notify_all();
+    }
+
+  private:
+    std::mutex lock;
+    std::condition_variable wakeup;
+    std::atomic<long> slice_end;
+    bool running;   /* whose turn it is: the search's or the owner's */
+    bool finished;
+};
+
+/* A team of threads for work that comes in phases, each of which must
+ * finish before the next begins. The helpers are started once, and wait
+ * between phases, instead of being created and joined for each one. */
+class ThreadTeam {
+  public:
+    explicit ThreadTeam(int size): job(NULL), phase(0), finished(0), quitting(false) {
+        for (int member = 1; member < size; ++member) {
+            helpers.push_back(std::thread([this, member]() { this->serve(member); }));
+        }
+    }
+    ~ThreadTeam() {
+        {
+            std::lock_guard<std::mutex> lk(lock);
+            quitting = true;
+        }
+        wakeup.notify_all();
+        for (int i=0; i < (int)helpers.size(); ++i) {
+            helpers[i].join();
+        }
+    }
+
+    /* Call fn(member) on every member of the team at once, the calling
+     * thread being member 0, and return when they have all finished. */
+    void run(const std::function<void(int)> &fn) {
+        {
+            std::lock_guard<std::mutex> lk(lock);
+            job = &fn;
+            finished = 0;
+            phase += 1;
+        }
+        wakeup.notify_all();
+        fn(0);
+        std::unique_lock<std::mutex> lk(lock);
+        done.wait(lk, [this]() { return finished == (int)helpers.size(); });
+        job = NULL;
+    }
+
+  private:
+    void serve(int member) {
+        unsigned long seen = 0;
+        while (true) {
+            const std::function<void(int)> *fn;
+            {
+                std::unique_lock<std::mutex> lk(lock);
+                wakeup.wait(lk, [&]() { return quitting || phase != seen; });
+                if (quitting) return;
+                seen = phase;
+                fn = job;
+            }
+            (*fn)(member);
+            {
+                std::lock_guard<std::mutex> lk(lock);
+                finished += 1;
+            }
+            done.notify_one();
+        }
+    }
+
+    std::vector<std::thread> helpers;
+    std::mutex lock;
+    std::condition_variable wakeup, done;
+    const std::function<void(int)> *job;
+    unsigned long phase;  /* how many times run() has been called */
+    int finished;         /* how many helpers have finished this phase */
+    bool quitting;
+};
+
+
+template<typename State        // a state of the world, not necessarily including whose turn it is
+        ,typename Move         // an indication of how to get from one state to another state
+        ,typename Value        // a scalar "goodness" measure (e.g., "int" or "double")
+        ,typename Undo = State // what it takes to undo a Move (by default, a copy of the old State)
+        ,typename Hooks = FunctionPointerHooks<State,Move,Value,Undo>  // the game's functions
+         >
+class AlphaBeta {
+    typedef FunctionPointerHooks<State,Move,Value,Undo> Pointers;
+    typedef typename Pointers::Evaluator Evaluator;
+    typedef typename Pointers::MoveApplier MoveApplier;
+    typedef typename Pointers::MoveMaker MoveMaker;
+    typedef typename Pointers::MoveUnmaker MoveUnmaker;
+    typedef typename Pointers::MoveFinder MoveFinder;
+    typedef typename Pointers::AttackerFinder AttackerFinder;
+    typedef typename Pointers::Hasher Hasher;
+    typedef typename Pointers::MoveClassifier MoveClassifier;
+    typedef typename Pointers::MoveIndexer MoveIndexer;
+
+    Hooks hooks;
+    TranspositionTable<Move,Value> *tt;
+
+    /* The move-ordering heuristics. "killers[h]" holds the two most recent
+     * quiet moves that caused a beta cutoff at height "h" (distance from
+     * the root); such a move is often just as good in the sibling
+     * positions. "history[indexmove(m)]" counts, weighted by depth, how
+     * often the quiet move "m" has caused a cutoff anywhere in the tree. */
+    struct Killers {
+        Move moves[2];
+        int count;
+        Killers(): count(0) { }
+    };
+    std::vector<Killers> killers;
+    std::vector<int> history;
+
+    /* "pvs[h]" receives the principal variation (the sequence of best
+     * moves) from the node currently being searched at height h. During
+     * iterative deepening, "prev_pv" is the principal variation from the
+     * previous iteration, and "following_pv" is true while the search is
+     * still walking down that line, so that it can be tried first. */
+    std::vector<std::vector<Move> > pvs;
+    std::vector<Move> prev_pv;
+    bool following_pv;
+
+    /* The selective search; see set_selectivity(). "after_null_move" is
+     * true on the way into the search of a null move, so that the node
+     * below knows not to pass straight back. */
+    bool null_move_pruning;
+    bool late_move_reductions;
+    bool after_null_move;
+    int quiescence_plies;
+
+    /* "move_stack[h]" and "score_stack[h]" hold the moves of the node
+     * currently being searched at height h, and their ordering scores.
+     * The depth-first searches reuse them from node to node, so that once
+     * they've grown big enough, searching doesn't allocate. They are
+     * deques so that growing them doesn't move the vectors that the
+     * nodes above are still using. */
+    std::deque<std::vector<Move> > move_stack;
+    std::deque<std::vector<int> > score_stack;
+    void find_moves_at(const State &st, int height) {
+        while ((int)move_stack.size() <= height) {
+            move_stack.push_back(std::vector<Move>());
+            score_stack.push_back(std::vector<int>());
+        }
+        move_stack[height].clear();
+        hooks.findmoves(st, move_stack[height]);
+    }
+
+    /* If "stop" is non-NULL, the depth-first alpha-beta search checks it
+     * at every node, and once it becomes true, unwinds as fast as it can
+     * and sets "aborted". The results of an aborted search are garbage.
+     * Likewise, if "deadline" is non-zero, it checks the clock every
+     * DEADLINE_POLL_NODES nodes, and aborts once now_usec() passes it. */
+    const std::atomic<bool> *stop;
+    bool aborted;
+    long deadline;
+    TimeSlicer *slicer;
+    unsigned long last_poll;  /* the value of "nodes" when we last did */
+
+    int deepen(State &root, int firstply, int maxply, long usec,
+               Move &bestmove, Value &bestvalue,
+               Value alpha, Value beta, Value aspiration);
 
-    const Evaluator evaluate;
-    const MoveApplier applymove;
-    const MoveFinder findmoves;
-    const AttackerFinder findattacker;
+    void order_moves(const State &st, int height, const Move *pvmove, const Move *hashmove,
+                     const std::vector<Move> &allmoves, std::vector<int> &scores);
+    static void pick_next_move(std::vector<Move> &allmoves, std::vector<int> &scores, int i);
+    void record_cutoff(const State &st, int ply, int height, const Move &move);
 
     int finddefender(const State &st) {
-        return 1-findattacker(st);
+        return 1-hooks.findattacker(st);
     }
-    // Return a high Value if s1's attacker wants to move to s2.
-    Value evaluate2(const State &s1, const State &s2) {
-        if (findattacker(s1) != findattacker(s2))
-          return evaluate(s2);
-        return -evaluate(s2);
+    // Return a high Value if "attacker" wants to move to s2.
+    Value evaluate2(int attacker, const State &s2) {
+        if (attacker != hooks.findattacker(s2))
+          return hooks.evaluate(s2);
+        return -hooks.evaluate(s2);
     }
 
+    // Apply a move using whichever of applymove() or makemove() we have.
+    void apply(State &st, const Move &move) {
+        if (hooks.has_applymove()) {
+            hooks.applymove(st, move);
+        } else {
+            Undo unused;
+            hooks.makemove(st, move, unused);
+        }
+    }
+    // Apply a move in place, and later take it back. If the game didn't
+    // supply makemove() and unmakemove(), then Undo must be State, and
+    // we'll just save a copy of the whole State.
+    void make(State &st, const Move &move, Undo &undo) {
+        if (hooks.has_makemove()) {
+            hooks.makemove(st, move, undo);
+        } else {
+            save_state(undo, st);
+            hooks.applymove(st, move);
+        }
+    }
+    void unmake(State &st, const Move &move, const Undo &undo) {
+        if (hooks.has_makemove()) {
+            hooks.unmakemove(st, move, undo);
+        } else {
+            restore_state(st, undo);
+        }
+    }
+    static void save_state(State &undo, const State &st) { undo = st; }
+    static void restore_state(State &st, const State &undo) { st = undo; }
+    template<typename U> static void save_state(U &, const State &) { assert(false); }
+    template<typename U> static void restore_state(State &, const U &) { assert(false); }
+
   public:
     AlphaBeta(Evaluator ev, MoveApplier app, MoveFinder fm, AttackerFinder fa):
-            evaluate(ev), applymove(app), findmoves(fm), findattacker(fa) { }
-    
+            hooks(ev, app, NULL, NULL, fm, fa, NULL, NULL, NULL), tt(NULL),
+            following_pv(false),
+            null_move_pruning(false), late_move_reductions(false), after_null_move(false), quiescence_plies(0),
+            stop(NULL), aborted(false), deadline(0), slicer(NULL), last_poll(0), nodes(0) { reset_stats(); }
+
+    /* If the game can supply a hash of each State, then
+     * depth_first_alpha_beta() can remember what it has already searched
+     * in a TranspositionTable, which must outlive this object. Move must
+     * be comparable with ==, so that we can recognize the table's
+     * suggested best move among the moves returned by findmoves(). */
+    AlphaBeta(Evaluator ev, MoveApplier app, MoveFinder fm, AttackerFinder fa,
+              Hasher fh, TranspositionTable<Move,Value> *t):
+            hooks(ev, app, NULL, NULL, fm, fa, fh, NULL, NULL), tt(t),
+            following_pv(false),
+            null_move_pruning(false), late_move_reductions(false), after_null_move(false), quiescence_plies(0),
+            stop(NULL), aborted(false), deadline(0), slicer(NULL), last_poll(0), nodes(0) { reset_stats(); }
+
+    /* If the game can make and unmake moves in place, then the searches
+     * need only ever copy the root State. The hash and table are optional,
+     * as above.
+     *   depth_first_alpha_beta() always tries the table's best move first.
+     * If the game can classify its moves as tactical or quiet, then the
+     * tactical moves come next, in order of classifymove(); then the
+     * "killer" moves for this ply; and then the rest. If the game also
+     * supplies indexmove(), with indices from 0 to history_size-1, then
+     * the rest are ordered by how often they've caused cutoffs elsewhere.
+     */
+    AlphaBeta(Evaluator ev, MoveMaker mk, MoveUnmaker unmk,
+              MoveFinder fm, AttackerFinder fa,
+              Hasher fh = NULL, TranspositionTable<Move,Value> *t = NULL,
+              MoveClassifier mc = NULL, MoveIndexer mi = NULL, int history_size = 0):
+            hooks(ev, NULL, mk, unmk, fm, fa, fh, mc, mi), tt(t),
+            history(mi ? history_size : 0), following_pv(false),
+            null_move_pruning(false), late_move_reductions(false), after_null_move(false), quiescence_plies(0),
+            stop(NULL), aborted(false), deadline(0), slicer(NULL), last_poll(0), nodes(0) { reset_stats(); }
+
+    /* If the game supplies its functions as a Hooks class (see
+     * AlphaBetaHooks), then there's nothing to pass in but the optional
+     * table and the size of the history table, as above. */
+    explicit AlphaBeta(TranspositionTable<Move,Value> *t = NULL, int history_size = 0):
+            hooks(), tt(t),
+            history(Hooks::has_indexer() ? history_size : 0), following_pv(false),
+            null_move_pruning(false), late_move_reductions(false), after_null_move(false), quiescence_plies(0),
+            stop(NULL), aborted(false), deadline(0), slicer(NULL), last_poll(0), nodes(0) { reset_stats(); }
+
+    /* The table may be swapped out, or turned off by passing NULL. */
+    TranspositionTable<Move,Value> *transposition_table() const { return tt; }
+    void set_transposition_table(TranspositionTable<Move,Value> *t) {
+        assert(t == NULL || hooks.has_hash());
+        tt = t;
+    }
+
+    /* The number of times any of the searches below has applied
+     * a move, i.e., the number of game-tree nodes visited.
+     * It is never reset automatically; callers who want to count
+     * the nodes in a single search should zero it first. */
+    unsigned long nodes;
+
+    /* More detailed statistics, for measuring the effect of move ordering.
+     * "nodes_at_height[h]" counts the moves applied at distance h from the
+     * root (so its total is the same as "nodes"). Of the beta cutoffs,
+     * "first_move_cutoffs" counts the ones caused by the first move tried;
+     * with perfect move ordering, that would be all of them. The selective
+     * search counts the null moves that caused a cutoff by themselves, the
+     * moves it searched at reduced depth, and how many of those it had to
+     * search again at full depth. "quiescence_nodes" counts the moves
+     * applied by the quiescence search, which are also in "nodes".
+     * "queue_operations" counts breadth_first()'s pushes and pops. */
+    struct Stats {
+        std::vector<unsigned long> nodes_at_height;
+        unsigned long cutoffs;
+        unsigned long first_move_cutoffs;
+        unsigned long null_move_cutoffs;
+        unsigned long reductions;
+        unsigned long researches;
+        unsigned long quiescence_nodes;
+        unsigned long queue_operations;
+    };
+    Stats stats;
+    void reset_stats() {
+        stats.nodes_at_height.clear();
+        stats.cutoffs = 0;
+        stats.first_move_cutoffs = 0;
+        stats.null_move_cutoffs = 0;
+        stats.reductions = 0;
+        stats.researches = 0;
+        stats.quiescence_nodes = 0;
+        stats.queue_operations = 0;
+    }
+
+    /* Call new_search() before each search from a new root. It ages the
+     * transposition table and the history counts, so that what we learned
+     * on previous moves is still used but gradually forgotten. forget()
+     * wipes all of it, which is useful for reproducible benchmarks. */
+    void new_search() {
+        if (tt != NULL) tt->new_search();
+        for (size_t i=0; i < history.size(); ++i) history[i] /= 2;
+        killers.clear();
+    }
+    void forget() {
+        if (tt != NULL) tt->clear();
+        std::fill(history.begin(), history.end(), 0);
+        killers.clear();
+    }
+
     /* Given a State, return the best possible move for the attacker (looking
      * "ply" plies deep).  If the attacker has no legal moves (not even
      * "pass"), then return false; else return true.
@@ -60,10 +522,16 @@ class AlphaBeta {
      * a winning move for "attacker", we'll set "bestvalue" to a negative value.
      */
     bool depth_first(const State &st, int ply,
-                     Move &bestmove, Value &bestvalue);
+                     Move &bestmove, Value &bestvalue) {
+        State root = st;
+        return this->depth_first_in_place(root, ply, 0, bestmove, bestvalue);
+    }
 
     /* Same deal as above, but using alpha-beta pruning to speed up the search
-     * for large values of "ply". On the initial call, "alpha" should be set
+     * for large values of "ply". The returned "bestvalue" is exact if it
+     * lies strictly between "alpha" and "beta"; otherwise it is only a
+     * bound ("fail-soft"), and "bestmove" is merely the move that caused
+     * the cutoff. On the initial call, "alpha" should be set
      * to the most negative Value and "beta" to the most positive Value.
      *   To search for a winning move (looking "ply" plies deep), start "alpha"
      * at something just a tiny bit less than the value of a won game, and "beta"
@@ -72,10 +540,149 @@ class AlphaBeta {
      * the game (looking "ply" plies deep), start "beta" at something just a
      * tiny bit greater than the value of a lost game, and "alpha" at the most
      * negative Value.
+     *   If a transposition table has been supplied, positions already
+     * searched at least "ply" plies deep are not searched again.
      */
     bool depth_first_alpha_beta(const State &st, int ply,
                                 Move &bestmove, Value &bestvalue,
-                                Value alpha, Value beta);
+                                Value alpha, Value beta) {
+        State root = st;
+        following_pv = false;
+        return this->alpha_beta_in_place(root, ply, 0, bestmove, bestvalue, alpha, beta);
+    }
+
+    /* Search with depth_first_alpha_beta() at ply 1, 2, 3, and so on up
+     * to "maxply". If "usec" is positive, the search gets that many
+     * microseconds in total. It won't start an iteration that it expects
+     * to overrun that budget, judging by the effective branching factor
+     * of the previous iterations; and if an iteration does overrun it anyway, the
+     * search checks the clock every DEADLINE_POLL_NODES nodes and
+     * abandons that iteration. The first iteration is always completed.
+     * Return the deepest ply completed, with "bestmove" and "bestvalue"
+     * set from that iteration; or return 0 if the attacker has no moves.
+     *   Each iteration first tries the previous iteration's principal
+     * variation, and (if "aspiration" is positive) searches only a window
+     * of width 2*aspiration around the expected value, within the full
+     * window given by "alpha" and "beta". If the value falls outside that
+     * narrow window, we search again with the window opened up on that
+     * side. If the value reaches "alpha" or "beta" themselves (e.g., a
+     * forced win or loss), deeper searches can't change it, so we stop.
+     */
+    int iterative_deepening(const State &st, int maxply, long usec,
+                            Move &bestmove, Value &bestvalue,
+                            Value alpha, Value beta, Value aspiration);
+
+    /* The same as iterative_deepening(), but with "threads"-1 helper
+     * threads searching the same root alongside it ("lazy SMP"). The
+     * helpers share only the transposition table, which is where they
+     * help: each one fills in results that the others can use. Half of
+     * them start one ply deeper than the main search, so that the threads
+     * spread out over neighbouring depths instead of all racing through
+     * the same tree. When the main search is done, the helpers are
+     * stopped, and if one of them completed a deeper iteration than the
+     * main search did, its result is used instead.
+     *   The helpers' nodes are added to "nodes", but "iterations" and
+     * "stats" describe only the main search. The functions supplied by
+     * the game must be safe to call from several threads at once. */
+    int parallel_iterative_deepening(const State &st, int threads, int maxply, long usec,
+                                     Move &bestmove, Value &bestvalue,
+                                     Value alpha, Value beta, Value aspiration);
+
+    /* A record of each iteration of the most recent iterative_deepening()
+     * call: the ply, its value, how long it took, how many nodes it
+     * visited, and how many times it had to be searched again after
+     * falling outside its aspiration window. */
+    struct Iteration {
+        int ply;
+        Value value;
+        long usec;
+        unsigned long nodes;
+        int researches;
+    };
+    std::vector<Iteration> iterations;
+
+    /* The principal variation found by the most recent iteration; after
+     * parallel_iterative_deepening(), that of whichever thread's result
+     * it returned, as are "iterations". */
+    const std::vector<Move> &principal_variation() const { return prev_pv; }
+
+    /* Search like depth_first_alpha_beta(), but with "threads" threads,
+     * using the "Young Brothers Wait" scheme. At each node at least
+     * YBW_MIN_SPLIT_PLY plies from the horizon, the first (eldest) move
+     * is searched on its own, to establish a bound; then its younger
+     * brothers become tasks which any idle thread may steal. A thread
+     * waiting for its brothers to finish works on tasks in the meantime.
+     * If one brother causes a beta cutoff, the brothers after it are
+     * cancelled.
+     *   The result is the same every run, no matter how many threads
+     * there are or who steals what, which makes it usable for regression
+     * tests. To get that, brothers searched in parallel all share the
+     * window left after the eldest, rather than narrowing it as each one
+     * finishes; the best move is the first one with the best value; and
+     * the transposition table, killers and history are used to order
+     * moves but not updated. The game's functions must be safe to call
+     * from several threads at once.
+     */
+    bool parallel_alpha_beta(const State &st, int ply, int threads,
+                             Move &bestmove, Value &bestvalue,
+                             Value alpha, Value beta);
+    enum { YBW_MIN_SPLIT_PLY = 3 };
+
+    /* How often a search with a deadline looks at the clock. This is a
+     * power of two; at a few million nodes a second, it's well under a
+     * millisecond. */
+    enum { DEADLINE_POLL_NODES = 1024 };
+
+    /* Make the depth-first alpha-beta search selective, trading a little
+     * accuracy for depth. Both are off to begin with, so that the search
+     * gives exactly the minimax value.
+     *   With "null_move", at each node at least NULL_MOVE_MIN_PLY plies
+     * from the horizon whose static value already reaches beta, the
+     * attacker first tries passing (if the game allows it; see
+     * AlphaBetaHooks) and searches the result NULL_MOVE_REDUCTION plies
+     * less deeply than usual, with a null window at beta. If even passing
+     * fails high, a real move would surely do at least as well, so the
+     * node is cut off without searching any. Two null moves are never
+     * made in a row, nor on the principal variation.
+     *   With "reductions", the quiet moves (according to classifymove())
+     * from the LMR_FULL_MOVES'th on, which move ordering says are unlikely
+     * to be any good, are searched one ply less deeply, with a null window
+     * at alpha; if one of them does beat alpha after all, it is searched
+     * again at full depth. */
+    void set_selectivity(bool null_move, bool reductions) {
+        null_move_pruning = null_move && hooks.has_nullmove();
+        late_move_reductions = reductions && hooks.has_classifier();
+    }
+    enum { NULL_MOVE_MIN_PLY = 3, NULL_MOVE_REDUCTION = 2 };
+    enum { LMR_MIN_PLY = 3, LMR_FULL_MOVES = 4 };
+
+    /* Rather than evaluating the positions at the horizon as they stand,
+     * let the depth-first alpha-beta search look up to "plies" plies
+     * further along the forcing moves (those with a positive
+     * classifymove()) from each of them, so that it doesn't misjudge a
+     * position in the middle of an exchange. At each node of this
+     * quiescence search the attacker may instead "stand pat" and take
+     * the position's static value, so if that already reaches beta,
+     * nothing is searched; except where makenullmove() says he may not
+     * pass, when he must try every move instead. Zero, to begin with,
+     * turns it off. */
+    void set_quiescence(int plies) {
+        quiescence_plies = hooks.has_classifier() ? plies : 0;
+    }
+
+    /* True if the last iterative_deepening() ran out of time partway
+     * through an iteration, which it then threw away. */
+    bool ran_out_of_time() const { return aborted; }
+
+    /* While "flag" is non-NULL, iterative_deepening() and
+     * parallel_iterative_deepening() check it at every node, and once
+     * it becomes true, abandon the iteration in progress and return
+     * the deepest one completed, just as if they'd run out of time. */
+    void set_stop_flag(const std::atomic<bool> *flag) { stop = flag; }
+
+    /* While "ts" is non-NULL, the depth-first alpha-beta search calls
+     * ts->checkpoint() every DEADLINE_POLL_NODES nodes. See AnytimeSearch. */
+    void set_time_slicer(TimeSlicer *ts) { slicer = ts; }
     
     /* Given a State, return the best possible move using alpha-beta pruning,
      * as above. However, rather than searching depth-first, we'll search
@@ -87,43 +694,160 @@ class AlphaBeta {
      *   In the depth-first search, after we'd recursed on all of a given
      * state's children, we would take the maximum of all their outputs.
      * In this breadth-first search, after we've pushed action records for
-     * all of a given state's children, we will push another action record
-     * indicating that it's time to "return a value" from this state.
+     * all of a given state's children, we will make another record of
+     * what it takes to "return a value" from this state: as soon as the
+     * last of its children reports its value, the state reports the best
+     * of them to its own parent, and so on up the tree.
      *   Once we've inserted "maxnodes" states into our queue,
      * we'll bottom out by using this->evaluate() on all the remaining
-     * states in the queue and processing the rest of the "value-returning"
-     * action records.
+     * states in the queue, which finishes off the "value-returning" records.
      */
     bool breadth_first(const State &st, int maxnodes,
                        Move &bestmove, Value &bestvalue);
+
+    /* The same search as breadth_first(), and the same tree, but built a
+     * whole level at a time by "threads" threads together, since the
+     * positions in a level don't depend on one another: the threads share
+     * out the move generation for each batch of a level's positions, the
+     * evaluate() calls for the leaves, and then, from the bottom level
+     * up, the work of taking the best of each position's children. Only
+     * deciding where "maxnodes" runs out is done by one thread alone, so
+     * that the tree is exactly that of breadth_first(). The value is
+     * always the same as breadth_first()'s; among moves of equal value,
+     * this picks the first, which breadth_first() may not.
+     *   The game's functions must be safe to call from several threads at
+     * once. */
+    bool parallel_breadth_first(const State &st, int threads, int maxnodes,
+                                Move &bestmove, Value &bestvalue);
   private:
-    enum BFR_type_t { RECURSE, RETURN };
-    struct BFRecord {
-        BFR_type_t type;
-        BFRecord *parent;
-        Move move;  // What move did we use to get here?
-                    // record->move may become record->parent->bestmove.
-        /* If type==RECURSE: */
-        State st;   // starting state
-        /* If type==RETURN: */
+    /* The recursive workers behind depth_first() and
+     * depth_first_alpha_beta(). Each one leaves "st" as it found it. */
+    bool depth_first_in_place(State &st, int ply, int height,
+                              Move &bestmove, Value &bestvalue);
+    bool alpha_beta_in_place(State &st, int ply, int height,
+                             Move &bestmove, Value &bestvalue,
+                             Value alpha, Value beta);
+    Value quiesce(State &st, int qply, int height, Value alpha, Value beta);
+
+    /* The machinery behind parallel_alpha_beta(). A SplitPoint is a node
+     * whose younger brothers are being searched in parallel; each Task is
+     * one of those brothers. "cutoff" is the index of the first brother
+     * known to cause a beta cutoff (or moves.size() if none has), so any
+     * task with a higher index is wasted work. A node is cancelled if it
+     * lies under such a task, at any SplitPoint above it. */
+    struct SplitPoint {
+        const State *st;
+        const std::vector<Move> *moves;
+        int ply, height, attacker;
+        Value alpha, beta;
+        std::vector<Value> values;
+        std::atomic<int> pending;
+        std::atomic<int> cutoff;
+        const SplitPoint *parent;
+        int parent_index;
+    };
+    struct Task {
+        SplitPoint *sp;
+        int index;
+    };
+    struct Worker {
+        std::mutex lock;
+        std::deque<Task> tasks;  /* pushed and popped at the back; stolen from the front */
+        unsigned long nodes;
+        bool cancelled;  /* set while unwinding from a cancelled task */
+    };
+    struct WorkerPool {
+        std::vector<Worker *> workers;
+        std::mutex lock;
+        std::condition_variable wakeup;
+        std::atomic<int> queued;
+        bool done;
+    };
+    static bool is_cancelled(const SplitPoint *sp, int index);
+    bool ybw_search(WorkerPool &pool, Worker &w, State &st, int ply, int height,
+                    const SplitPoint *sp, int index,
+                    Move &bestmove, Value &bestvalue, Value alpha, Value beta);
+    bool ybw_search_move(WorkerPool &pool, Worker &w, State &st, const Move &move,
+                         int attacker, int ply, int height, const SplitPoint *sp, int index,
+                         Value alpha, Value beta, Value &value_to_me);
+    bool ybw_get_task(WorkerPool &pool, Worker &w, Task &task);
+    void ybw_run_task(WorkerPool &pool, Worker &w, const Task &task);
+
+    /* The records of breadth_first(). A RECURSE record is a move yet to
+     * be searched, from the position of its parent; a RETURN record is a
+     * position whose moves are being searched, which returns the best of
+     * their values to its own parent once they have all reported. RECURSE
+     * records are searched in the order they were added to the pool, so
+     * the pool is also the queue. Neither holds a State: the
+     * position a move is made from is rebuilt by replaying the moves from
+     * the root. The records live in these pools, and refer to each other
+     * by index (-1 for none), so that a search allocates almost nothing;
+     * the pools are emptied at the end of each search, but keep their
+     * memory for the next one. */
+    struct BFRecurse {
+        Move move;
+        int parent;  /* a RETURN record */
+    };
+    struct BFReturn {
+        Move move;   /* the move from the parent's position to this one */
+        int parent;
         int unreported_children;
         int attacker;
         bool hasbestvalue;
         Value bestvalue;
-        Move bestmove;  // The best move from this point; its value is bestvalue
-
-        BFRecord(BFR_type_t t, const State &s, const Move &m, BFRecord *p):
-            type(t), parent(p), move(m), st(s)
-            { assert(t == RECURSE); assert(!p || p->type == RETURN); }
-        BFRecord(BFR_type_t t, const Move &m, int u, int a, BFRecord *p):
-            type(t), parent(p), move(m), unreported_children(u), attacker(a), hasbestvalue(false)
-            { assert(t == RETURN); assert(!p || p->type == RETURN); }
+        Move bestmove;  /* the best move from this position; its value is bestvalue */
+    };
+    std::vector<BFRecurse> bf_recurse;
+    std::vector<BFReturn> bf_return;
+    std::vector<Move> bf_path;
+    int bf_new_return(const Move &move, int parent, int children, int attacker) {
+        BFReturn r;
+        r.move = move;
+        r.parent = parent;
+        r.unreported_children = children;
+        r.attacker = attacker;
+        r.hasbestvalue = false;
+        bf_return.push_back(r);
+        return (int)bf_return.size() - 1;
+    }
+    void bf_report(int parent, int attacker, const Move &move, Value value_to_mover);
+    void bf_rebuild(const State &root, int node, State &st);
+
+    /* The tree of parallel_breadth_first(), in breadth-first order, so
+     * that each level, and each position's children, are contiguous. The
+     * root is node 0. A position whose moves haven't been searched (a
+     * leaf) has no children, and its value comes from evaluate(). */
+    struct PBFNode {
+        Move move;         /* the move from the parent's position to this one */
+        int parent;
+        int attacker;      /* the attacker in this position */
+        int first_child;
+        int num_children;
+        Value value;       /* to the player who made "move" */
+    };
+    std::vector<PBFNode> pbf_nodes;
+    std::vector<std::vector<Move> > pbf_moves;  /* for each node of the batch being expanded */
+    /* Each thread rebuilds positions from the root as bf_rebuild() does,
+     * but keeps the last one, since neighbouring nodes share a parent. */
+    struct PBFScratch {
+        State st;
+        int node;
+        std::vector<Move> path;
+        std::vector<Move> moves;    /* for evaluatemoves() */
+        std::vector<Value> values;
+        explicit PBFScratch(const State &root): st(root), node(0) { }
     };
+    enum { PBF_BATCH = 1 << 14, PBF_CHUNK = 64 };
+    const State &pbf_parent_position(const State &root, PBFScratch &scratch, int parent);
+    void pbf_position(const State &root, PBFScratch &scratch, int node, State &st);
+    void pbf_evaluate_leaves(const State &root, PBFScratch &scratch, int first, int end);
+    template <typename Fn>
+    static void pbf_for(ThreadTeam &team, size_t begin, size_t end, Fn fn);
 };
 
 
-template <typename State, typename Move, typename Value>
-bool AlphaBeta<State,Move,Value>::depth_first(const State &st, int ply,
+template <typename State, typename Move, typename Value, typename Undo, typename Hooks>
+bool AlphaBeta<State,Move,Value,Undo,Hooks>::depth_first_in_place(State &st, int ply, int height,
                                               Move &bestmove, Value &bestvalue)
 {
     assert(ply >= 0);
@@ -134,9 +858,9 @@ bool AlphaBeta<State,Move,Value>::depth_first(const State &st, int ply,
      * to do when we hit the ply limit as well. */
     if (ply == 0)
       return false;
-    const int attacker = this->findattacker(st);
-    std::vector<Move> allmoves;
-    this->findmoves(st, allmoves);
+    const int attacker = hooks.findattacker(st);
+    this->find_moves_at(st, height);
+    std::vector<Move> &allmoves = move_stack[height];
     /* If the attacker has no possible moves (not even a move corresponding
      * to "pass", if this game allows players to pass), then the game is
      * over. Return false, meaning "game over", as explained above. */
@@ -148,13 +872,14 @@ bool AlphaBeta<State,Move,Value>::depth_first(const State &st, int ply,
      * we run AlphaBeta.depth_first() on it from the opponent's point of view,
      * we get back a very positive number.
      */
-    Value highestvalue;
+    Value highestvalue = Value();
     int highestidx = -1;
     for (int i=0; i < (int)allmoves.size(); ++i) {
-        State newstate = st;
-        this->applymove(newstate, allmoves[i]);
+        Undo undo;
+        this->make(st, allmoves[i], undo);
+        this->nodes += 1;
         Move dbestmove; // unused
-        /* "dhighestvalue" will receive the value of "newstate" from the
+        /* "dhighestvalue" will receive the value of the new state from the
          * point of view of "newattacker" (who is trying to maximize that
          * value). If newattacker != attacker, as in chess or checkers,
          * then the value of this move to "attacker" will be the negation
@@ -162,9 +887,9 @@ bool AlphaBeta<State,Move,Value>::depth_first(const State &st, int ply,
          * of this move to the attacker is obviously dhighestvalue itself. */
         Value dhighestvalue;
         Value value_to_me;
-        const int newattacker = findattacker(newstate);
+        const int newattacker = hooks.findattacker(st);
         /* Generally, we'd expect that newattacker != attacker. */
-        const bool foundmove = this->depth_first(newstate, ply-1, dbestmove, dhighestvalue);
+        const bool foundmove = this->depth_first_in_place(st, ply-1, height+1, dbestmove, dhighestvalue);
         if (!foundmove) {
             /* If the defender has no moves left, then the game is definitely
              * over. We must evaluate this position to see how happy we are
@@ -173,10 +898,11 @@ bool AlphaBeta<State,Move,Value>::depth_first(const State &st, int ply,
              * with it, then it is a position in which we have lost the game
              * by making this move.
              */
-            value_to_me = this->evaluate2(st, newstate);
+            value_to_me = this->evaluate2(attacker, st);
         } else {
             value_to_me = (newattacker != attacker) ? -dhighestvalue : dhighestvalue;
         }
+        this->unmake(st, allmoves[i], undo);
         if (highestidx == -1 || value_to_me > highestvalue) {
             highestidx = i;
             highestvalue = value_to_me;
@@ -197,9 +923,9 @@ bool AlphaBeta<State,Move,Value>::depth_first(const State &st, int ply,
  * optimally to counter him; it starts at +inf and gets lower.
  * "Alpha" and "beta" swap places every half-move down the tree.
  */
-template <typename State, typename Move, typename Value>
-bool AlphaBeta<State,Move,Value>::depth_first_alpha_beta(
-                                              const State &st, int ply,
+template <typename State, typename Move, typename Value, typename Undo, typename Hooks>
+bool AlphaBeta<State,Move,Value,Undo,Hooks>::alpha_beta_in_place(
+                                              State &st, int ply, int height,
                                               Move &bestmove, Value &bestvalue,
                                               Value alpha, Value beta)
 {
@@ -209,29 +935,128 @@ bool AlphaBeta<State,Move,Value>::depth_first_alpha_beta(
      * This is exactly correct in the case where the game is actually over
      * (see below), and coincidentally it turns out to be the right thing
      * to do when we hit the ply limit as well. */
-    if (ply == 0)
-      return false;
-    const int attacker = this->findattacker(st);
-    std::vector<Move> allmoves;
-    this->findmoves(st, allmoves);
+    if (stop != NULL && stop->load(std::memory_order_relaxed)) {
+        aborted = true;
+        return false;
+    }
+    /* This is above the base case, since most nodes are leaves; and it
+     * counts nodes since the last look rather than waiting for "nodes"
+     * to hit a multiple, since quiesce() may step over that. */
+    if (nodes - last_poll >= DEADLINE_POLL_NODES) {
+        last_poll = nodes;
+        if (deadline != 0 && now_usec() >= deadline) {
+            aborted = true;
+            return false;
+        }
+        if (slicer != NULL)
+          slicer->checkpoint();
+    }
+    if (ply == 0) {
+        if (quiescence_plies == 0)
+          return false;
+        if ((int)pvs.size() <= height)
+          pvs.resize(height+1);
+        pvs[height].clear();
+        bestvalue = this->quiesce(st, 0, height, alpha, beta);
+        return true;
+    }
+
+    const bool on_pv = following_pv;
+    const bool parent_passed = after_null_move;
+    after_null_move = false;
+    if ((int)pvs.size() <= height+1)
+      pvs.resize(height+2);
+    pvs[height].clear();
+
+    /* If we've already searched this position at least this deeply,
+     * we may be able to reuse the result without searching again. If
+     * we can't, the table's best move is still the most promising
+     * move to try first. */
+    const Value original_alpha = alpha;
+    uint64_t key = 0;
+    typename TranspositionTable<Move,Value>::Entry tte;
+    bool have_tte = false;
+    if (tt != NULL) {
+        key = hooks.findhash(st);
+        have_tte = tt->probe(key, tte);
+        if (have_tte && tte.depth >= ply) {
+            const Value v = tte.value;
+            if (tte.bound == TranspositionTable<Move,Value>::EXACT ||
+                (tte.bound == TranspositionTable<Move,Value>::LOWER && v >= beta) ||
+                (tte.bound == TranspositionTable<Move,Value>::UPPER && v <= alpha)) {
+                bestmove = tte.move;
+                bestvalue = v;
+                return true;
+            }
+        }
+    }
+
+    const int attacker = hooks.findattacker(st);
+    this->find_moves_at(st, height);
+    std::vector<Move> &allmoves = move_stack[height];
     /* If the attacker has no possible moves (not even a move corresponding
      * to "pass", if this game allows players to pass), then the game is
      * over. Return false, meaning "game over", as explained above. */
     if (allmoves.empty())
       return false;
+    if ((int)stats.nodes_at_height.size() <= height)
+      stats.nodes_at_height.resize(height+1);
+
+    /* Null-move pruning: see set_selectivity(). */
+    if (null_move_pruning && height > 0 && !on_pv && !parent_passed &&
+        ply >= NULL_MOVE_MIN_PLY && -hooks.evaluate(st) >= beta) {
+        Undo undo;
+        if (hooks.makenullmove(st, undo)) {
+            this->nodes += 1;
+            stats.nodes_at_height[height] += 1;
+            Move unused;
+            Value dvalue;
+            after_null_move = true;
+            const bool found = this->alpha_beta_in_place(st, ply-1-NULL_MOVE_REDUCTION, height+1,
+                                                         unused, dvalue, -beta, -beta+1);
+            after_null_move = false;
+            const Value value_to_me = found ? -dvalue : this->evaluate2(attacker, st);
+            hooks.unmakenullmove(st, undo);
+            if (aborted)
+              return false;
+            if (value_to_me >= beta) {
+                /* We have no actual move to report, nor to store in
+                 * the table; the caller only wants the bound anyway. */
+                stats.null_move_cutoffs += 1;
+                pvs[height].clear();
+                bestmove = allmoves[0];
+                bestvalue = value_to_me;
+                return true;
+            }
+        }
+    }
+
+    std::vector<int> &scores = score_stack[height];
+    const bool have_pvmove = on_pv && height < (int)prev_pv.size();
+    this->order_moves(st, height, have_pvmove ? &prev_pv[height] : NULL,
+                      have_tte ? &tte.move : NULL, allmoves, scores);
     /* Otherwise, the attacker has some possible moves, and we're going to
      * look more than one ply deep.  The best move in these cases is the move
      * which the attacker is happiest to defend --- i.e., the move where if
      * we run AlphaBeta.depth_first() on it from the opponent's point of view,
      * we get back a very positive number.
      */
-    Value highestvalue;
+    Value highestvalue = Value();
     int highestidx = -1;
     for (int i=0; i < (int)allmoves.size(); ++i) {
-        State newstate = st;
-        this->applymove(newstate, allmoves[i]);
+        pick_next_move(allmoves, scores, i);
+        /* Late-move reductions: see set_selectivity(). The move must be
+         * classified before it's made. */
+        bool reduce = late_move_reductions && i >= LMR_FULL_MOVES && ply >= LMR_MIN_PLY &&
+                      !(have_pvmove && allmoves[i] == prev_pv[height]) &&
+                      !(have_tte && allmoves[i] == tte.move) &&
+                      hooks.classifymove(st, allmoves[i]) == 0;
+        Undo undo;
+        this->make(st, allmoves[i], undo);
+        this->nodes += 1;
+        stats.nodes_at_height[height] += 1;
         Move dbestmove; // unused
-        /* "dhighestvalue" will receive the value of "newstate" from the
+        /* "dhighestvalue" will receive the value of the new state from the
          * point of view of "newattacker" (who is trying to maximize that
          * value). If newattacker != attacker, as in chess or checkers,
          * then the value of this move to "attacker" will be the negation
@@ -239,9 +1064,38 @@ bool AlphaBeta<State,Move,Value>::depth_first_alpha_beta(
          * of this move to the attacker is obviously dhighestvalue itself. */
         Value dhighestvalue;
         Value value_to_me;
-        const int newattacker = findattacker(newstate);
-        /* Generally, we'd expect that newattacker != attacker. */
-        const bool foundmove = this->depth_first(newstate, ply-1, dbestmove, dhighestvalue);
+        const int newattacker = hooks.findattacker(st);
+        /* Generally, we'd expect that newattacker != attacker, in which
+         * case the child's window is our window negated and swapped: a
+         * child value of -alpha or less is a "win" for us that we'd still
+         * want to see exactly, and a child value of -beta or more means
+         * the child is going to refute this move no matter what. */
+        bool foundmove;
+        following_pv = have_pvmove && (allmoves[i] == prev_pv[height]);
+        if (newattacker != attacker) {
+            if (reduce) {
+                stats.reductions += 1;
+                foundmove = this->alpha_beta_in_place(st, ply-2, height+1,
+                                dbestmove, dhighestvalue, -alpha-1, -alpha);
+                value_to_me = foundmove ? -dhighestvalue : this->evaluate2(attacker, st);
+                if (!aborted && value_to_me > alpha) {
+                    stats.researches += 1;
+                    reduce = false;
+                }
+            }
+            if (!reduce) {
+                foundmove = this->alpha_beta_in_place(st, ply-1, height+1,
+                                dbestmove, dhighestvalue, -beta, -alpha);
+            }
+        } else {
+            foundmove = this->alpha_beta_in_place(st, ply-1, height+1,
+                            dbestmove, dhighestvalue, alpha, beta);
+        }
+        following_pv = false;
+        if (aborted) {
+            this->unmake(st, allmoves[i], undo);
+            return false;
+        }
         if (!foundmove) {
             /* If the defender has no moves left, then the game is definitely
              * over. We must evaluate this position to see how happy we are
@@ -250,10 +1104,11 @@ bool AlphaBeta<State,Move,Value>::depth_first_alpha_beta(
              * with it, then it is a position in which we have lost the game
              * by making this move.
              */
-            value_to_me = this->evaluate2(st, newstate);
+            value_to_me = this->evaluate2(attacker, st);
         } else {
             value_to_me = (newattacker != attacker) ? -dhighestvalue : dhighestvalue;
         }
+        this->unmake(st, allmoves[i], undo);
         if (highestidx == -1 || value_to_me > highestvalue) {
             highestidx = i;
             highestvalue = value_to_me;
@@ -262,15 +1117,441 @@ bool AlphaBeta<State,Move,Value>::depth_first_alpha_beta(
              * we should set alpha = max(alpha, value_to_me). */
             if (value_to_me > alpha) {
                 alpha = value_to_me;
+                /* This is our principal variation, unless it's about to
+                 * be cut off. */
+                std::vector<Move> &pv = pvs[height];
+                pv.clear();
+                pv.push_back(allmoves[i]);
+                if (foundmove)
+                  pv.insert(pv.end(), pvs[height+1].begin(), pvs[height+1].end());
                 if (value_to_me >= beta) {
                     /* We know we can't possibly do better than beta,
                      * so if we've found a move worth at least beta
                      * then we can stop looking. */
+                    stats.cutoffs += 1;
+                    stats.first_move_cutoffs += (i == 0);
+                    this->record_cutoff(st, ply, height, allmoves[i]);
                     goto bail_out_early;
                 }
             }
         }
     }
+  bail_out_early:
+    assert(highestidx != -1);
+    bestmove = allmoves[highestidx];
+    bestvalue = highestvalue;
+    if (tt != NULL) {
+        typename TranspositionTable<Move,Value>::Bound bound;
+        if (highestvalue <= original_alpha)
+          bound = TranspositionTable<Move,Value>::UPPER;
+        else if (highestvalue >= beta)
+          bound = TranspositionTable<Move,Value>::LOWER;
+        else
+          bound = TranspositionTable<Move,Value>::EXACT;
+        tt->store(key, ply, bound, highestvalue, bestmove);
+    }
+    return true;
+}
+
+
+/* The quiescence search (see set_quiescence()) from "st", which is "qply"
+ * plies past the horizon. Return its value to the attacker: fail-soft,
+ * like alpha_beta_in_place(). */
+template <typename State, typename Move, typename Value, typename Undo, typename Hooks>
+Value AlphaBeta<State,Move,Value,Undo,Hooks>::quiesce(State &st, int qply, int height,
+                                                Value alpha, Value beta)
+{
+    /* The attacker can decline to play a forcing move, unless he's being
+     * forced himself: if he may not pass (see makenullmove()), standing
+     * pat would be just as misleading, and he must try all his moves. */
+    bool forced = false;
+    if (hooks.has_nullmove() && qply < quiescence_plies) {
+        Undo undo;
+        forced = !hooks.makenullmove(st, undo);
+        if (!forced)
+          hooks.unmakenullmove(st, undo);
+    }
+    Value highestvalue = -hooks.evaluate(st);
+    if (!forced) {
+        if (highestvalue >= beta || qply >= quiescence_plies)
+          return highestvalue;
+        if (highestvalue > alpha)
+          alpha = highestvalue;
+    }
+
+    this->find_moves_at(st, height);
+    std::vector<Move> &allmoves = move_stack[height];
+    std::vector<int> &scores = score_stack[height];
+    scores.resize(allmoves.size());
+    for (int i=0; i < (int)allmoves.size(); ++i) {
+        scores[i] = hooks.classifymove(st, allmoves[i]);
+    }
+    if ((int)stats.nodes_at_height.size() <= height)
+      stats.nodes_at_height.resize(height+1);
+
+    const int attacker = hooks.findattacker(st);
+    bool have_value = !forced;  /* is "highestvalue" a real option yet? */
+    for (int i=0; i < (int)allmoves.size(); ++i) {
+        pick_next_move(allmoves, scores, i);
+        if (scores[i] <= 0 && !forced)
+          break;  /* the rest are quiet */
+        Undo undo;
+        this->make(st, allmoves[i], undo);
+        this->nodes += 1;
+        stats.nodes_at_height[height] += 1;
+        stats.quiescence_nodes += 1;
+        Value value_to_me;
+        if (hooks.findattacker(st) != attacker)
+          value_to_me = -this->quiesce(st, qply+1, height+1, -beta, -alpha);
+        else
+          value_to_me = this->quiesce(st, qply+1, height+1, alpha, beta);
+        this->unmake(st, allmoves[i], undo);
+        if (!have_value || value_to_me > highestvalue) {
+            have_value = true;
+            highestvalue = value_to_me;
+            if (value_to_me > alpha) {
+                if (value_to_me >= beta)
+                  break;
+                alpha = value_to_me;
+            }
+        }
+    }
+    return highestvalue;
+}
+
+
+template <typename State, typename Move, typename Value, typename Undo, typename Hooks>
+int AlphaBeta<State,Move,Value,Undo,Hooks>::iterative_deepening(const State &st, int maxply, long usec,
+                                                          Move &bestmove, Value &bestvalue,
+                                                          Value alpha, Value beta, Value aspiration)
+{
+    State root = st;
+    return this->deepen(root, 1, maxply, usec, bestmove, bestvalue, alpha, beta, aspiration);
+}
+
+template <typename State, typename Move, typename Value, typename Undo, typename Hooks>
+int AlphaBeta<State,Move,Value,Undo,Hooks>::parallel_iterative_deepening(const State &st, int threads,
+                                                                   int maxply, long usec,
+                                                                   Move &bestmove, Value &bestvalue,
+                                                                   Value alpha, Value beta,
+                                                                   Value aspiration)
+{
+    if (threads <= 1)
+      return this->iterative_deepening(st, maxply, usec, bestmove, bestvalue, alpha, beta, aspiration);
+
+    struct Helper {
+        AlphaBeta engine;
+        State root;
+        int firstply;
+        int completed;
+        Move bestmove;
+        Value bestvalue;
+        Helper(const AlphaBeta &ab, const State &st, int first):
+            engine(ab), root(st), firstply(first), completed(0) { }
+    };
+    std::atomic<bool> stop_helpers(false);
+    std::vector<Helper *> helpers;
+    std::vector<std::thread> workers;
+    for (int i=1; i < threads; ++i) {
+        Helper *h = new Helper(*this, st, 1 + (i % 2));
+        h->engine.stop = &stop_helpers;
+        h->engine.slicer = NULL;  /* only the main search is paused */
+        h->engine.nodes = 0;
+        helpers.push_back(h);
+    }
+    for (int i=0; i < (int)helpers.size(); ++i) {
+        Helper *h = helpers[i];
+        workers.push_back(std::thread([h, maxply, alpha, beta, aspiration]() {
+            h->completed = h->engine.deepen(h->root, h->firstply, maxply, 0,
+                                            h->bestmove, h->bestvalue,
+                                            alpha, beta, aspiration);
+        }));
+    }
+
+    State root = st;
+    int completed = this->deepen(root, 1, maxply, usec, bestmove, bestvalue, alpha, beta, aspiration);
+
+    stop_helpers = true;
+    for (int i=0; i < (int)workers.size(); ++i)
+      workers[i].join();
+    for (int i=0; i < (int)helpers.size(); ++i) {
+        Helper *h = helpers[i];
+        if (h->completed > completed) {
+            /* Take its principal variation and iterations too, so that
+             * they go with the depth and move we return. */
+            completed = h->completed;
+            bestmove = h->bestmove;
+            bestvalue = h->bestvalue;
+            prev_pv = h->engine.prev_pv;
+            iterations = h->engine.iterations;
+        }
+        nodes += h->engine.nodes;
+        delete h;
+    }
+    return completed;
+}
+
+/* Do the work of iterative_deepening(), starting at "firstply" and
+ * leaving "root" as it found it. If the search is aborted, return the
+ * deepest iteration completed before that. */
+template <typename State, typename Move, typename Value, typename Undo, typename Hooks>
+int AlphaBeta<State,Move,Value,Undo,Hooks>::deepen(State &root, int firstply, int maxply, long usec,
+                                             Move &bestmove, Value &bestvalue,
+                                             Value alpha, Value beta, Value aspiration)
+{
+    const long start = now_usec();
+    iterations.clear();
+    prev_pv.clear();
+    aborted = false;
+
+    int completed = 0;
+    for (int ply = firstply; ply <= maxply; ++ply) {
+        if (usec > 0 && iterations.size() >= 2) {
+            /* Predict this iteration's nodes from the last one's, times the
+             * effective branching factor (the growth in nodes from one ply
+             * to the next), and its time from the time per node. Both tend
+             * to differ a lot between odd and even plies, so take them
+             * from the iteration two plies back, when we can. */
+            const int n = iterations.size();
+            const Iteration &last = iterations[n-1];
+            const Iteration &like = (n >= 3) ? iterations[n-2] : last;
+            const Iteration &before_like = (n >= 3) ? iterations[n-3] : iterations[n-2];
+            double ebf = (double)like.nodes / std::max(before_like.nodes, 1UL);
+            if (ebf < 1) ebf = 1;
+            const double usec_per_node = (double)like.usec / std::max(like.nodes, 1UL);
+            if (now_usec() - start + last.nodes * ebf * usec_per_node > usec)
+              break;
+        }
+        /* Give up on this iteration if it runs past the budget after all,
+         * unless it's the first one, since we need some move or other. */
+        deadline = (usec > 0 && completed > 0) ? start + usec : 0;
+
+        /* The window is centered on the value from two iterations ago,
+         * rather than the last one, since many games' evaluations seesaw
+         * depending on whose move it is at the horizon. */
+        Value a = alpha;
+        Value b = beta;
+        const int n = iterations.size();
+        if (aspiration > 0 && n >= 1) {
+            const Value expected = iterations[(n >= 2) ? n-2 : n-1].value;
+            if (expected - aspiration > a) a = expected - aspiration;
+            if (expected + aspiration < b) b = expected + aspiration;
+        }
+
+        Iteration it;
+        it.ply = ply;
+        it.researches = 0;
+        const unsigned long nodes_before = nodes;
+        const long iter_start = now_usec();
+        Move move;
+        Value value;
+        bool found;
+        while (true) {
+            following_pv = true;
+            found = this->alpha_beta_in_place(root, ply, 0, move, value, a, b);
+            if (!found)
+              break;
+            if (value <= a && a > alpha) {
+                a = alpha;
+            } else if (value >= b && b < beta) {
+                b = beta;
+            } else {
+                break;
+            }
+            it.researches += 1;
+        }
+        following_pv = false;
+        deadline = 0;
+        if (!found)
+          return completed;
+        it.value = value;
+        it.usec = now_usec() - iter_start;
+        it.nodes = nodes - nodes_before;
+        iterations.push_back(it);
+
+        bestmove = move;
+        bestvalue = value;
+        prev_pv = pvs[0];
+        if (prev_pv.empty() || !(prev_pv[0] == move)) {
+            /* The root value came straight from the transposition table. */
+            prev_pv.assign(1, move);
+        }
+        completed = ply;
+        if (value <= alpha || value >= beta)
+          break;
+    }
+    return completed;
+}
+
+template <typename State, typename Move, typename Value, typename Undo, typename Hooks>
+bool AlphaBeta<State,Move,Value,Undo,Hooks>::parallel_alpha_beta(const State &st, int ply, int threads,
+                                                           Move &bestmove, Value &bestvalue,
+                                                           Value alpha, Value beta)
+{
+    assert(threads >= 1);
+    WorkerPool pool;
+    pool.queued = 0;
+    pool.done = false;
+    for (int i=0; i < threads; ++i) {
+        Worker *w = new Worker;
+        w->nodes = 0;
+        w->cancelled = false;
+        pool.workers.push_back(w);
+    }
+    /* This thread is worker 0; the others just steal tasks until we're done. */
+    std::vector<std::thread> helpers;
+    for (int i=1; i < threads; ++i) {
+        Worker *w = pool.workers[i];
+        helpers.push_back(std::thread([this, &pool, w]() {
+            Task task;
+            while (true) {
+                {
+                    std::unique_lock<std::mutex> lk(pool.lock);
+                    pool.wakeup.wait(lk, [&pool]() { return pool.done || pool.queued > 0; });
+                    if (pool.done)
+                      return;
+                }
+                if (this->ybw_get_task(pool, *w, task))
+                  this->ybw_run_task(pool, *w, task);
+            }
+        }));
+    }
+
+    State root = st;
+    const bool found = this->ybw_search(pool, *pool.workers[0], root, ply, 0, NULL, 0,
+                                        bestmove, bestvalue, alpha, beta);
+    {
+        std::lock_guard<std::mutex> lk(pool.lock);
+        pool.done = true;
+    }
+    pool.wakeup.notify_all();
+    for (int i=0; i < (int)helpers.size(); ++i)
+      helpers[i].join();
+    for (int i=0; i < threads; ++i) {
+        this->nodes += pool.workers[i]->nodes;
+        delete pool.workers[i];
+    }
+    return found;
+}
+
+template <typename State, typename Move, typename Value, typename Undo, typename Hooks>
+bool AlphaBeta<State,Move,Value,Undo,Hooks>::is_cancelled(const SplitPoint *sp, int index)
+{
+    for ( ; sp != NULL; index = sp->parent_index, sp = sp->parent) {
+        if (index > sp->cutoff.load(std::memory_order_relaxed))
+          return true;
+    }
+    return false;
+}
+
+/* The same as alpha_beta_in_place(), except for splitting. "sp" and
+ * "index" say which task this node lies under, if any. If the node is
+ * cancelled, set w.cancelled and return false. */
+template <typename State, typename Move, typename Value, typename Undo, typename Hooks>
+bool AlphaBeta<State,Move,Value,Undo,Hooks>::ybw_search(WorkerPool &pool, Worker &w,
+                                                  State &st, int ply, int height,
+                                                  const SplitPoint *sp, int index,
+                                                  Move &bestmove, Value &bestvalue,
+                                                  Value alpha, Value beta)
+{
+    assert(ply >= 0);
+    if (ply == 0)
+      return false;
+    if (is_cancelled(sp, index)) {
+        w.cancelled = true;
+        return false;
+    }
+
+    typename TranspositionTable<Move,Value>::Entry tte;
+    const bool have_tte = (tt != NULL && tt->probe(hooks.findhash(st), tte));
+    const int attacker = hooks.findattacker(st);
+    /* A worker runs stolen tasks, at any height, while it waits for its
+     * brothers; so these moves can't live in move_stack. */
+    std::vector<Move> allmoves;
+    hooks.findmoves(st, allmoves);
+    if (allmoves.empty())
+      return false;
+    const int n = allmoves.size();
+    std::vector<int> scores;
+    this->order_moves(st, height, NULL, have_tte ? &tte.move : NULL, allmoves, scores);
+    for (int i=0; i < n; ++i)
+      pick_next_move(allmoves, scores, i);
+
+    /* Search the eldest brother first; and if we're too near the horizon
+     * for splitting to pay off, search all the rest one by one too. */
+    Value highestvalue = Value();
+    int highestidx = -1;
+    int i;
+    for (i=0; i < n; ++i) {
+        if (i >= 1 && ply >= YBW_MIN_SPLIT_PLY)
+          break;
+        Value value_to_me;
+        if (!this->ybw_search_move(pool, w, st, allmoves[i], attacker, ply, height,
+                                   sp, index, alpha, beta, value_to_me))
+          return false;
+        if (highestidx == -1 || value_to_me > highestvalue) {
+            highestidx = i;
+            highestvalue = value_to_me;
+            if (value_to_me > alpha) {
+                alpha = value_to_me;
+                if (value_to_me >= beta)
+                  goto bail_out_early;
+            }
+        }
+    }
+
+    if (i < n) {
+        /* Offer the younger brothers up for stealing, youngest first,
+         * so that we'll pop them off our own deque eldest first. */
+        SplitPoint split;
+        split.st = &st;
+        split.moves = &allmoves;
+        split.ply = ply;
+        split.height = height;
+        split.attacker = attacker;
+        split.alpha = alpha;
+        split.beta = beta;
+        split.values.resize(n);
+        split.pending = n - i;
+        split.cutoff = n;
+        split.parent = sp;
+        split.parent_index = index;
+        {
+            std::lock_guard<std::mutex> lk(w.lock);
+            for (int j = n-1; j >= i; --j) {
+                Task task = { &split, j };
+                w.tasks.push_back(task);
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lk(pool.lock);
+            pool.queued += n - i;
+        }
+        pool.wakeup.notify_all();
+
+        /* "st" mustn't change until all the brothers are done, since the
+         * tasks copy it; so work on whatever tasks we can find meanwhile. */
+        Task task;
+        while (split.pending.load(std::memory_order_acquire) > 0) {
+            if (this->ybw_get_task(pool, w, task)) {
+                this->ybw_run_task(pool, w, task);
+            } else {
+                std::this_thread::yield();
+            }
+        }
+        if (is_cancelled(sp, index)) {
+            w.cancelled = true;
+            return false;
+        }
+        const int last = std::min(split.cutoff.load(), n-1);
+        for (int j = i; j <= last; ++j) {
+            if (split.values[j] > highestvalue) {
+                highestidx = j;
+                highestvalue = split.values[j];
+            }
+        }
+    }
+
   bail_out_early:
     assert(highestidx != -1);
     bestmove = allmoves[highestidx];
@@ -278,102 +1559,277 @@ bool AlphaBeta<State,Move,Value>::depth_first_alpha_beta(
     return true;
 }
 
+/* Make "move", search the position after it, and take it back again,
+ * setting "value_to_me" to its value to "attacker". Return false
+ * if the search was cancelled. */
+template <typename State, typename Move, typename Value, typename Undo, typename Hooks>
+bool AlphaBeta<State,Move,Value,Undo,Hooks>::ybw_search_move(WorkerPool &pool, Worker &w,
+                                                       State &st, const Move &move,
+                                                       int attacker, int ply, int height,
+                                                       const SplitPoint *sp, int index,
+                                                       Value alpha, Value beta,
+                                                       Value &value_to_me)
+{
+    Undo undo;
+    this->make(st, move, undo);
+    w.nodes += 1;
+    Move dbestmove; // unused
+    Value dhighestvalue;
+    const int newattacker = hooks.findattacker(st);
+    bool foundmove;
+    if (newattacker != attacker) {
+        foundmove = this->ybw_search(pool, w, st, ply-1, height+1, sp, index,
+                                     dbestmove, dhighestvalue, -beta, -alpha);
+    } else {
+        foundmove = this->ybw_search(pool, w, st, ply-1, height+1, sp, index,
+                                     dbestmove, dhighestvalue, alpha, beta);
+    }
+    if (w.cancelled) {
+        this->unmake(st, move, undo);
+        return false;
+    }
+    if (!foundmove) {
+        value_to_me = this->evaluate2(attacker, st);
+    } else {
+        value_to_me = (newattacker != attacker) ? -dhighestvalue : dhighestvalue;
+    }
+    this->unmake(st, move, undo);
+    return true;
+}
 
-template <typename State, typename Move, typename Value>
-bool AlphaBeta<State,Move,Value>::breadth_first(const State &st, int maxnodes,
+/* Take the most recently pushed task from our own deque, or
+ * failing that, the oldest task from someone else's. */
+template <typename State, typename Move, typename Value, typename Undo, typename Hooks>
+bool AlphaBeta<State,Move,Value,Undo,Hooks>::ybw_get_task(WorkerPool &pool, Worker &w, Task &task)
+{
+    if (pool.queued.load(std::memory_order_relaxed) == 0)
+      return false;
+    {
+        std::lock_guard<std::mutex> lk(w.lock);
+        if (!w.tasks.empty()) {
+            task = w.tasks.back();
+            w.tasks.pop_back();
+            pool.queued -= 1;
+            return true;
+        }
+    }
+    for (int i=0; i < (int)pool.workers.size(); ++i) {
+        Worker &victim = *pool.workers[i];
+        if (&victim == &w)
+          continue;
+        std::lock_guard<std::mutex> lk(victim.lock);
+        if (!victim.tasks.empty()) {
+            task = victim.tasks.front();
+            victim.tasks.pop_front();
+            pool.queued -= 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename State, typename Move, typename Value, typename Undo, typename Hooks>
+void AlphaBeta<State,Move,Value,Undo,Hooks>::ybw_run_task(WorkerPool &pool, Worker &w, const Task &task)
+{
+    SplitPoint &split = *task.sp;
+    State st = *split.st;
+    Value value_to_me;
+    if (this->ybw_search_move(pool, w, st, (*split.moves)[task.index], split.attacker,
+                              split.ply, split.height, &split, task.index,
+                              split.alpha, split.beta, value_to_me)) {
+        split.values[task.index] = value_to_me;
+        if (value_to_me >= split.beta) {
+            /* Cancel the brothers after this one. */
+            int c = split.cutoff.load();
+            while (task.index < c && !split.cutoff.compare_exchange_weak(c, task.index))
+              continue;
+        }
+    }
+    w.cancelled = false;
+    split.pending.fetch_sub(1, std::memory_order_release);
+}
+
+/* Give each move a score saying how early it should be searched:
+ * first the previous iteration's principal-variation move, then the
+ * hash move, then tactical moves, then killers, then the
+ * quiet moves in order of their history counts. */
+template <typename State, typename Move, typename Value, typename Undo, typename Hooks>
+void AlphaBeta<State,Move,Value,Undo,Hooks>::order_moves(const State &st, int height,
+                                                   const Move *pvmove,
+                                                   const Move *hashmove,
+                                                   const std::vector<Move> &allmoves,
+                                                   std::vector<int> &scores)
+{
+    enum {
+        HASH_MOVE = 1 << 30,
+        TACTICAL_MOVE = 1 << 24,
+        KILLER_MOVE = 1 << 20,  /* history counts are kept below this */
+    };
+    const Killers *k = ((int)killers.size() > height) ? &killers[height] : NULL;
+    scores.resize(allmoves.size());
+    for (int i=0; i < (int)allmoves.size(); ++i) {
+        const Move &m = allmoves[i];
+        int tactical;
+        if (pvmove != NULL && m == *pvmove) {
+            scores[i] = HASH_MOVE + 1;
+        } else if (hashmove != NULL && m == *hashmove) {
+            scores[i] = HASH_MOVE;
+        } else if (hooks.has_classifier() && (tactical = hooks.classifymove(st, m)) > 0) {
+            scores[i] = TACTICAL_MOVE + tactical;
+        } else if (k != NULL && k->count >= 1 && m == k->moves[0]) {
+            scores[i] = KILLER_MOVE + 1;
+        } else if (k != NULL && k->count >= 2 && m == k->moves[1]) {
+            scores[i] = KILLER_MOVE;
+        } else if (hooks.has_indexer()) {
+            scores[i] = history[hooks.indexmove(m)];
+        } else {
+            scores[i] = 0;
+        }
+    }
+}
+
+/* Swap the best-scoring move among allmoves[i..] into position i.
+ * Doing this lazily, rather than sorting all the moves up front, saves
+ * work whenever one of the first few moves causes a cutoff. Ties keep
+ * the order in which findmoves() produced the moves. */
+template <typename State, typename Move, typename Value, typename Undo, typename Hooks>
+void AlphaBeta<State,Move,Value,Undo,Hooks>::pick_next_move(std::vector<Move> &allmoves,
+                                                      std::vector<int> &scores, int i)
+{
+    int best = i;
+    for (int j = i+1; j < (int)allmoves.size(); ++j) {
+        if (scores[j] > scores[best]) best = j;
+    }
+    if (best != i) {
+        std::rotate(allmoves.begin()+i, allmoves.begin()+best, allmoves.begin()+best+1);
+        std::rotate(scores.begin()+i, scores.begin()+best, scores.begin()+best+1);
+    }
+}
+
+/* A quiet move just caused a beta cutoff; remember it as a killer at
+ * this height, and credit it in the history table. */
+template <typename State, typename Move, typename Value, typename Undo, typename Hooks>
+void AlphaBeta<State,Move,Value,Undo,Hooks>::record_cutoff(const State &st, int ply, int height,
+                                                     const Move &move)
+{
+    if (!hooks.has_classifier() || hooks.classifymove(st, move) > 0)
+      return;
+    if ((int)killers.size() <= height)
+      killers.resize(height+1);
+    Killers &k = killers[height];
+    if (k.count == 0 || !(k.moves[0] == move)) {
+        k.moves[1] = k.moves[0];
+        k.moves[0] = move;
+        if (k.count < 2) k.count += 1;
+    }
+    if (hooks.has_indexer()) {
+        int &h = history[hooks.indexmove(move)];
+        h += ply * ply;
+        if (h >= (1 << 20)) {
+            for (size_t i=0; i < history.size(); ++i) history[i] /= 2;
+        }
+    }
+}
+
+
+/* Credit the RETURN record "parent" with one of its moves, "move",
+ * which is worth "value" to "attacker". If that was the last of its moves
+ * to report, then its value is settled, so report that to its own parent
+ * in turn, and so on up the tree. */
+template <typename State, typename Move, typename Value, typename Undo, typename Hooks>
+void AlphaBeta<State,Move,Value,Undo,Hooks>::bf_report(int parent, int attacker, const Move &move,
+                                                Value value)
+{
+    for (Move m = move; parent != -1; ) {
+        BFReturn &p = bf_return[parent];
+        /* Namely, this move is one of the parent's, and has not yet reported. */
+        assert(p.unreported_children > 0);
+        const Value value_to_parent = (attacker != p.attacker) ? -value : value;
+        if (!p.hasbestvalue || value_to_parent > p.bestvalue) {
+            p.hasbestvalue = true;
+            p.bestvalue = value_to_parent;
+            p.bestmove = m;
+        }
+        p.unreported_children -= 1;
+        if (p.unreported_children > 0)
+          break;
+        /* p.bestvalue is the value of the position p.move leads to, from
+         * the point of view of the attacker there. */
+        attacker = p.attacker;
+        value = p.bestvalue;
+        m = p.move;
+        parent = p.parent;
+    }
+}
+
+/* Set "st" to the position of the RETURN record "node", by replaying
+ * the moves that lead to it from "root". */
+template <typename State, typename Move, typename Value, typename Undo, typename Hooks>
+void AlphaBeta<State,Move,Value,Undo,Hooks>::bf_rebuild(const State &root, int node, State &st)
+{
+    bf_path.clear();
+    for (int n = node; bf_return[n].parent != -1; n = bf_return[n].parent) {
+        bf_path.push_back(bf_return[n].move);
+    }
+    st = root;
+    for (int i = (int)bf_path.size() - 1; i >= 0; --i) {
+        this->apply(st, bf_path[i]);
+    }
+}
+
+template <typename State, typename Move, typename Value, typename Undo, typename Hooks>
+bool AlphaBeta<State,Move,Value,Undo,Hooks>::breadth_first(const State &st, int maxnodes,
                                                 Move &bestmove, Value &bestvalue)
 {
     assert(maxnodes >= 0);
     if (maxnodes == 0)
       return false;
 
-    std::queue<BFRecord *> Q;
-    
     /* The queue starts out with all the moves from this state. */
     std::vector<Move> allmoves;
-    this->findmoves(st, allmoves);
+    hooks.findmoves(st, allmoves);
     /* If the attacker has no moves, return false. */
     if (allmoves.empty())
         return false;
 
     /* Otherwise, initialize the queue by pushing action records for each of
-     * the attacker's possible moves. Link them all to "return_record", which
-     * has a parent of NULL --- that's how we'll know when we hit the top of
-     * the game tree again. */
+     * the attacker's possible moves. Link them all to the top-level RETURN
+     * record, which has no parent --- that's how we'll know when we hit the
+     * top of the game tree again. */
+    bf_recurse.clear();
+    bf_return.clear();
     int insertednodes = 0;
-    BFRecord *top_level_return_record = new BFRecord(RETURN, Move(), (int)allmoves.size(), this->findattacker(st), NULL);
+    const int top_level_return_record = bf_new_return(Move(), -1, (int)allmoves.size(), hooks.findattacker(st));
     for (int i=0; i < (int)allmoves.size(); ++i) {
-        Q.push(new BFRecord(RECURSE, st, allmoves[i], top_level_return_record));
+        BFRecurse child = { allmoves[i], top_level_return_record };
+        bf_recurse.push_back(child);
         insertednodes += 1;
         if (insertednodes == maxnodes) {
-            top_level_return_record->unreported_children = i+1;
+            bf_return[top_level_return_record].unreported_children = i+1;
             break;
         }
     }
-    Q.push(top_level_return_record);
+    stats.queue_operations += bf_recurse.size();
     
-    /* The queue is now initialized. */
+    /* The queue is now initialized. A node's moves are queued together,
+     * so we rebuild the position they're made from only once per node. */
+    State parentstate = st;
+    int parentnode = top_level_return_record;
 
-    for ( ; !Q.empty(); Q.pop()) {
+    for (size_t index = 0; index < bf_recurse.size(); ++index) {
         assert(insertednodes <= maxnodes);
-        BFRecord *record = Q.front();
-
-        if (record->type == RETURN) {
-            assert(record->unreported_children >= 0);
-            if (record->unreported_children > 0) {
-                /* We can't process this record yet; not all of its children
-                 * have reported in. Throw it back into the queue. */
-                Q.push(record);
-                continue;
-            } else {
-                assert(record->unreported_children == 0);
-                if (record->parent == NULL) {
-                    /* This is the very first record pushed on the queue,
-                     * the one that holds this function's actual return
-                     * values. Break out of the loop at this point. */
-                    assert(record == top_level_return_record);
-                    assert(record->hasbestvalue);
-                    bestmove = record->bestmove;
-                    bestvalue = record->bestvalue;
-                    /* Note that "record" is still in the queue. */
-                    goto delete_any_remaining_queue_elements;
-                }
-                /* Otherwise, record.bestvalue holds the Value of record.move
-                 * (a move which yields record.state), from the point of view
-                 * of the attacker who just made that move. We need to
-                 * propagate that bestvalue up to our parent. */
-                assert(record->parent != NULL);
-                /* Namely, this record is a child of its parent, and this
-                 * record has not yet reported. */
-                assert(record->parent->unreported_children > 0);
-                assert(record->hasbestvalue);
-
-                Value value_to_parent;
-                if (record->attacker != record->parent->attacker)
-                  value_to_parent = -record->bestvalue;
-                else
-                  value_to_parent = record->bestvalue;
-                if (!record->parent->hasbestvalue || value_to_parent > record->parent->bestvalue) {
-                    record->parent->hasbestvalue = true;
-                    record->parent->bestvalue = value_to_parent;
-                    record->parent->bestmove = record->move;
-                }
-                record->parent->unreported_children -= 1;
-                delete record;
-                continue;
-            }
+        stats.queue_operations += 1;
+        /* A copy, since pushing more records may move the pool. */
+        const BFRecurse record = bf_recurse[index];
+        assert(bf_return[record.parent].unreported_children > 0);
+        if (record.parent != parentnode) {
+            this->bf_rebuild(st, record.parent, parentstate);
+            parentnode = record.parent;
         }
-        
-        assert(record->type == RECURSE);
-        assert(record->parent != NULL);
-        assert(record->parent->type == RETURN);
-        /* Namely, this record is a child of its parent, and this record has
-         * not yet reported. */
-        assert(record->parent->unreported_children > 0);
-        
-        State newstate = record->st;
-        this->applymove(newstate, record->move);
-        const int newattacker = this->findattacker(newstate);
+        const int mover = bf_return[record.parent].attacker;
+        State newstate = parentstate;
+        this->apply(newstate, record.move);
+        this->nodes += 1;
 
         /* Now this is basically the same code as depth_first(). */
             
@@ -384,20 +1840,7 @@ bool AlphaBeta<State,Move,Value>::breadth_first(const State &st, int maxnodes,
          */
         if (insertednodes == maxnodes) {
       easy_evaluate:
-            Value value_to_me = this->evaluate2(record->st, newstate);
-            Value value_to_parent;
-            if (this->findattacker(record->st) != record->parent->attacker)
-              value_to_parent = -value_to_me;
-            else
-              value_to_parent = value_to_me;
-
-            if (!record->parent->hasbestvalue || value_to_parent > record->parent->bestvalue) {
-                record->parent->hasbestvalue = true;
-                record->parent->bestvalue = value_to_parent;
-                record->parent->bestmove = record->move;
-            }
-            record->parent->unreported_children -= 1;
-            delete record;
+            this->bf_report(record.parent, mover, record.move, this->evaluate2(mover, newstate));
             continue;
         }
         
@@ -406,8 +1849,8 @@ bool AlphaBeta<State,Move,Value>::breadth_first(const State &st, int maxnodes,
          * of this position is going to be computed by taking the maximum of
          * the values of all its children. Push a record for each child, where
          * that record contains a link to the new RETURN record. */
-        std::vector<Move> allmoves;
-        this->findmoves(newstate, allmoves);
+        allmoves.clear();
+        hooks.findmoves(newstate, allmoves);
         if (allmoves.empty()) {
             /* If the new attacker has no moves left, then the game is
              * definitely over. We must evaluate this position to see how
@@ -417,46 +1860,303 @@ bool AlphaBeta<State,Move,Value>::breadth_first(const State &st, int maxnodes,
         
         /* The new attacker has some possible moves, and we're not yet
          * wrapping things up. So push a RECURSE record for each possible
-         * move, and push a RETURN record to defer the final processing on
-         * this node.
+         * move, and make a RETURN record to collect their values.
          */
-        BFRecord *return_record = new BFRecord(RETURN, record->move, (int)allmoves.size(), newattacker, record->parent);
+        const int return_record = bf_new_return(record.move, record.parent, (int)allmoves.size(),
+                                                hooks.findattacker(newstate));
         for (int i=0; i < (int)allmoves.size(); ++i) {
-            Q.push(new BFRecord(RECURSE, newstate, allmoves[i], return_record));
+            BFRecurse child = { allmoves[i], return_record };
+            bf_recurse.push_back(child);
+            stats.queue_operations += 1;
             insertednodes += 1;
             if (insertednodes == maxnodes) {
-                return_record->unreported_children = i+1;
+                bf_return[return_record].unreported_children = i+1;
                 break;
             }
         }
-        Q.push(return_record);
-        
-        /* We have now successfully suspended the rest of this computation.
-         * This record can now be disposed of. */
-        delete record;
         assert(insertednodes <= maxnodes);
         /* If insertednodes == maxnodes at this point, we enter the
-         * "wrapping things up" phase (see above), in which we start using
-         * this->evaluate() on whatever nodes of the game tree still remain
-         * in Q, rather than calling findmoves() on them.
+         * "wrapping things up" phase (see above), in which we take the
+         * rest of the RECURSE records still ahead of "index" as leaves,
+         * calling this->evaluate() on them rather than findmoves(). Each
+         * leaf's value goes straight to bf_report(), which passes a
+         * RETURN record's best value up to its parent as soon as the
+         * last of its children has reported.
          */
     }
-    /* The loop above will exit only if the queue becomes empty. This should
-     * never happen, because before the queue can empty completely we must
-     * encounter "top_level_return_record", and at that point we'll jump to
-     * "delete_any_remaining_queue_elements" below. */
-    assert(false);
+    /* Once every move has been searched, every RETURN record has heard
+     * from all of its children, right up to the top. All the records are
+     * freed together. */
+    const BFReturn &top = bf_return[top_level_return_record];
+    assert(top.unreported_children == 0 && top.hasbestvalue);
+    bestmove = top.bestmove;
+    bestvalue = top.bestvalue;
+    bf_recurse.clear();
+    bf_return.clear();
+    return true;
+}
 
-  delete_any_remaining_queue_elements:
-    delete Q.front();
-    Q.pop();
-    assert(Q.empty());
-    while (!Q.empty()) {
-        delete Q.front();
-        Q.pop();
+/* Call fn(i, thread) for each i from "begin" up to "end", on the threads
+ * of "team", each one taking PBF_CHUNK consecutive values of i at a time. */
+template <typename State, typename Move, typename Value, typename Undo, typename Hooks>
+template <typename Fn>
+void AlphaBeta<State,Move,Value,Undo,Hooks>::pbf_for(ThreadTeam &team, size_t begin, size_t end, Fn fn)
+{
+    std::atomic<size_t> next(begin);
+    auto run = [&](int thread) {
+        while (true) {
+            const size_t lo = next.fetch_add(PBF_CHUNK);
+            if (lo >= end) break;
+            const size_t hi = std::min(lo + PBF_CHUNK, end);
+            for (size_t i = lo; i < hi; ++i) {
+                fn(i, thread);
+            }
+        }
+    };
+    /* Not worth waking anyone up for. */
+    if (end - begin <= PBF_CHUNK)
+      run(0);
+    else
+      team.run(run);
+}
+
+/* Return the position of "parent", which is the last position "scratch"
+ * rebuilt, more often than not. */
+template <typename State, typename Move, typename Value, typename Undo, typename Hooks>
+const State &AlphaBeta<State,Move,Value,Undo,Hooks>::pbf_parent_position(const State &root,
+                                                                   PBFScratch &scratch, int parent)
+{
+    if (scratch.node != parent) {
+        scratch.path.clear();
+        for (int n = parent; n != 0; n = pbf_nodes[n].parent) {
+            scratch.path.push_back(pbf_nodes[n].move);
+        }
+        scratch.st = root;
+        for (int i = (int)scratch.path.size() - 1; i >= 0; --i) {
+            this->apply(scratch.st, scratch.path[i]);
+        }
+        scratch.node = parent;
+    }
+    return scratch.st;
+}
+
+/* Set "st" to the position of "node". */
+template <typename State, typename Move, typename Value, typename Undo, typename Hooks>
+void AlphaBeta<State,Move,Value,Undo,Hooks>::pbf_position(const State &root, PBFScratch &scratch,
+                                                   int node, State &st)
+{
+    if (node == 0) {
+        st = root;
+        return;
     }
+    st = this->pbf_parent_position(root, scratch, pbf_nodes[node].parent);
+    this->apply(st, pbf_nodes[node].move);
+}
+
+/* Evaluate the leaves from "first" up to "end", which are all children
+ * of the same position, with one call to evaluatemoves(). Their
+ * "attacker" isn't needed, and is left alone. */
+template <typename State, typename Move, typename Value, typename Undo, typename Hooks>
+void AlphaBeta<State,Move,Value,Undo,Hooks>::pbf_evaluate_leaves(const State &root,
+                                                          PBFScratch &scratch,
+                                                          int first, int end)
+{
+    const int n = end - first;
+    scratch.moves.resize(n);
+    scratch.values.resize(n);
+    for (int i=0; i < n; ++i) {
+        scratch.moves[i] = pbf_nodes[first + i].move;
+    }
+    const State &parent = this->pbf_parent_position(root, scratch, pbf_nodes[first].parent);
+    hooks.evaluatemoves(parent, scratch.moves.data(), n, scratch.values.data());
+    for (int i=0; i < n; ++i) {
+        pbf_nodes[first + i].value = scratch.values[i];
+    }
+}
+
+template <typename State, typename Move, typename Value, typename Undo, typename Hooks>
+bool AlphaBeta<State,Move,Value,Undo,Hooks>::parallel_breadth_first(const State &st, int threads,
+                                                             int maxnodes, Move &bestmove,
+                                                             Value &bestvalue)
+{
+    assert(maxnodes >= 0);
+    if (maxnodes == 0)
+      return false;
+    if (threads < 1) threads = 1;
+    ThreadTeam team(threads);
+
+    pbf_nodes.clear();
+    PBFNode root = { Move(), -1, hooks.findattacker(st), -1, 0, Value() };
+    pbf_nodes.push_back(root);
+    std::vector<PBFScratch> scratch(threads, PBFScratch(st));
+    if ((int)pbf_moves.size() < PBF_BATCH)
+      pbf_moves.resize(PBF_BATCH);
+
+    /* Each level is the range [begin, end) of "pbf_nodes". */
+    std::vector<size_t> levels(1, 0);
+    int remaining = maxnodes;
+    size_t begin = 0, end = 1;
+    while (begin < end) {
+        /* Find the moves from each position in the level, a batch at a
+         * time; then give each position children for its moves, in order,
+         * until we run out of nodes. A position with no moves is a leaf,
+         * and can be evaluated while we're there. */
+        size_t i = begin;
+        while (i < end && remaining > 0) {
+            const size_t batch_begin = i;
+            const size_t batch_end = std::min(end, i + (size_t)PBF_BATCH);
+            pbf_for(team, batch_begin, batch_end, [&](size_t n, int thread) {
+                State pos = st;
+                this->pbf_position(st, scratch[thread], (int)n, pos);
+                PBFNode &node = pbf_nodes[n];
+                node.attacker = hooks.findattacker(pos);
+                std::vector<Move> &moves = pbf_moves[n - batch_begin];
+                moves.clear();
+                hooks.findmoves(pos, moves);
+                if (moves.empty() && n != 0)
+                  node.value = this->evaluate2(pbf_nodes[node.parent].attacker, pos);
+            });
+            for ( ; i < batch_end && remaining > 0; ++i) {
+                const std::vector<Move> &moves = pbf_moves[i - batch_begin];
+                if (moves.empty()) {
+                    /* If the attacker at the root has no moves, return false. */
+                    if (i == 0) return false;
+                    continue;
+                }
+                const int k = std::min((int)moves.size(), remaining);
+                pbf_nodes[i].first_child = (int)pbf_nodes.size();
+                pbf_nodes[i].num_children = k;
+                for (int c=0; c < k; ++c) {
+                    PBFNode child = { moves[c], (int)i, 0, -1, 0, Value() };
+                    pbf_nodes.push_back(child);
+                }
+                remaining -= k;
+            }
+        }
+        /* We're wrapping up: the rest of the level are leaves. Where the
+         * game can evaluate many positions at once, each run of siblings
+         * goes in one call, made on behalf of its first member. */
+        if (hooks.has_batch_evaluator()) {
+            const size_t leaves_begin = i, leaves_end = end;
+            pbf_for(team, leaves_begin, leaves_end, [&](size_t n, int thread) {
+                const int parent = pbf_nodes[n].parent;
+                if (n != leaves_begin && pbf_nodes[n-1].parent == parent)
+                  return;
+                size_t last = n + 1;
+                while (last < leaves_end && pbf_nodes[last].parent == parent)
+                  ++last;
+                this->pbf_evaluate_leaves(st, scratch[thread], (int)n, (int)last);
+            });
+        } else {
+            pbf_for(team, i, end, [&](size_t n, int thread) {
+                State pos = st;
+                this->pbf_position(st, scratch[thread], (int)n, pos);
+                PBFNode &node = pbf_nodes[n];
+                node.attacker = hooks.findattacker(pos);
+                node.value = this->evaluate2(pbf_nodes[node.parent].attacker, pos);
+            });
+        }
+        begin = end;
+        end = pbf_nodes.size();
+        levels.push_back(end);
+    }
+    this->nodes += pbf_nodes.size() - 1;
+
+    /* Now each position takes the best of its children's values, which
+     * are to its own attacker, and turns it into a value to the player who
+     * moved into it; a level at a time, from the bottom up. */
+    for (int l = (int)levels.size() - 2; l >= 0; --l) {
+        pbf_for(team, levels[l], levels[l+1], [&](size_t n, int) {
+            PBFNode &node = pbf_nodes[n];
+            if (node.num_children == 0 || n == 0)
+              return;
+            Value best = pbf_nodes[node.first_child].value;
+            for (int c = node.first_child + 1; c < node.first_child + node.num_children; ++c) {
+                best = std::max(best, pbf_nodes[c].value);
+            }
+            node.value = (node.attacker != pbf_nodes[node.parent].attacker) ? -best : best;
+        });
+    }
+    const PBFNode &top = pbf_nodes[0];
+    int best = top.first_child;
+    for (int c = top.first_child + 1; c < top.first_child + top.num_children; ++c) {
+        if (pbf_nodes[c].value > pbf_nodes[best].value)
+          best = c;
+    }
+    bestmove = pbf_nodes[best].move;
+    bestvalue = pbf_nodes[best].value;
+    pbf_nodes.clear();
     return true;
 }
 
+/* An iterative-deepening search that runs only when stepped, so that
+ * its owner can get on with other things in between; think of it as
+ * parallel_iterative_deepening() turned inside out. The search itself
+ * runs on a thread of its own, using "engine", which nothing else may
+ * use until this object is destroyed. Only that thread is paused
+ * between steps; any helper threads keep going.
+ *   Between steps, the owner can ask for the best move so far, i.e.,
+ * the result of the deepest iteration completed, and its principal
+ * variation. Cancelling the token makes the search give up at its next
+ * node; the owner should then step it once more (or destroy it) to let
+ * it unwind. Destroying an unfinished search cancels its token. */
+template<typename State, typename Move, typename Value, typename Undo, typename Hooks>
+class AnytimeSearch {
+  public:
+    typedef AlphaBeta<State,Move,Value,Undo,Hooks> Engine;
+
+    AnytimeSearch(Engine &engine, const State &st, int threads, int maxply,
+                  Value alpha, Value beta, Value aspiration, CancellationToken &token):
+        engine(engine), token(token), root(st)
+    {
+        engine.set_stop_flag(token.as_flag());
+        engine.set_time_slicer(&slicer);
+        thread = std::thread([this, threads, maxply, alpha, beta, aspiration]() {
+            this->slicer.checkpoint();  /* wait for the first step */
+            this->engine.parallel_iterative_deepening(this->root, threads, maxply, 0,
+                                                      this->bestmove, this->bestvalue,
+                                                      alpha, beta, aspiration);
+            this->slicer.finish();
+        });
+    }
+    ~AnytimeSearch() {
+        token.cancel();
+        while (!slicer.is_finished())
+          slicer.run_for(1000*1000);
+        thread.join();
+        engine.set_time_slicer(NULL);
+        engine.set_stop_flag(NULL);
+    }
+
+    /* Let the search run for up to "usec" microseconds. Return false
+     * if it has finished (or been cancelled), and true if there's more
+     * to do. */
+    bool step(long usec) {
+        slicer.run_for(usec);
+        return !slicer.is_finished();
+    }
+
+    /* The deepest iteration completed so far, and its result; false if
+     * none has been completed yet. */
+    bool best_so_far(Move &move, Value &value, int &ply) const {
+        if (engine.iterations.empty())
+          return false;
+        move = bestmove;
+        value = bestvalue;
+        ply = engine.iterations.back().ply;
+        return true;
+    }
+    const std::vector<Move> &principal_variation() const { return engine.principal_variation(); }
+
+  private:
+    Engine &engine;
+    CancellationToken &token;
+    const State root;
+    TimeSlicer slicer;
+    std::thread thread;
+    Move bestmove;
+    Value bestvalue;
+};
+
 #endif /* H_ALPHABETA */
 
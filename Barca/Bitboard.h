@@ -0,0 +1,142 @@
+#pragma once
+
+#include <stdint.h>
+
+/* A set of squares on the 10x10 Barca board, one bit per square.
+ * Square (x,y) is bit number 10*y+x; bits 100 through 127 are
+ * always zero. */
+typedef unsigned __int128 Bitboard;
+
+inline int square_at(int x, int y) { return 10*y + x; }
+inline int square_x(int sq) { return sq % 10; }
+inline int square_y(int sq) { return sq / 10; }
+
+inline Bitboard square_bit(int sq) { return (Bitboard)1 << sq; }
+inline Bitboard square_bit(int x, int y) { return square_bit(square_at(x, y)); }
+
+inline int popcount(Bitboard b)
+{
+    return __builtin_popcountll((uint64_t)b) + __builtin_popcountll((uint64_t)(b >> 64));
+}
+
+/* Return the index of the lowest set bit; "b" must not be empty. */
+inline int lowest_square(Bitboard b)
+{
+    const uint64_t lo = (uint64_t)b;
+    if (lo != 0) return __builtin_ctzll(lo);
+    return 64 + __builtin_ctzll((uint64_t)(b >> 64));
+}
+
+/* Return the index of the highest set bit; "b" must not be empty. */
+inline int highest_square(Bitboard b)
+{
+    const uint64_t hi = (uint64_t)(b >> 64);
+    if (hi != 0) return 127 - __builtin_clzll(hi);
+    return 63 - __builtin_clzll((uint64_t)b);
+}
+
+/* Remove and return the lowest square in "b". */
+inline int pop_lowest_square(Bitboard &b)
+{
+    const int sq = lowest_square(b);
+    b &= b - 1;
+    return sq;
+}
+
+/* All 100 squares of the board. */
+const Bitboard ALL_SQUARES = ((Bitboard)1 << 100) - 1;
+
+/* The ten squares in column x. */
+constexpr Bitboard column_squares(int x)
+{
+    Bitboard b = 0;
+    for (int y=0; y < 10; ++y) b |= (Bitboard)1 << (10*y + x);
+    return b;
+}
+const Bitboard WEST_EDGE = column_squares(0);
+const Bitboard EAST_EDGE = column_squares(9);
+
+/* The four waterholes, at (3,3), (3,6), (6,3), and (6,6). */
+const Bitboard WATERHOLES = ((Bitboard)1 << 33) | ((Bitboard)1 << 36) |
+                            ((Bitboard)1 << 63) | ((Bitboard)1 << 66);
+
+/* Return "b" together with every square adjacent to a square in "b",
+ * orthogonally or diagonally. This is the set of squares in which a
+ * piece would be scared by a predator standing on any square in "b". */
+inline Bitboard adjacent_or_same(Bitboard b)
+{
+    const Bitboard row = b | ((b & ~EAST_EDGE) << 1) | ((b & ~WEST_EDGE) >> 1);
+    return (row | (row << 10) | (row >> 10)) & ALL_SQUARES;
+}
+
+/* The eight directions in which pieces move. Mice move like rooks
+ * (the first four), lions like bishops (the last four), and elephants
+ * like queens. Moving EAST, SOUTH, SOUTHEAST or SOUTHWEST takes a piece
+ * to a higher-numbered square. */
+enum Direction {
+    EAST, SOUTH, WEST, NORTH,
+    SOUTHEAST, SOUTHWEST, NORTHWEST, NORTHEAST
+};
+constexpr int direction_dx(int d) { return (d == EAST || d == SOUTHEAST || d == NORTHEAST) ? 1 :
+                                           (d == WEST || d == SOUTHWEST || d == NORTHWEST) ? -1 : 0; }
+constexpr int direction_dy(int d) { return (d == SOUTH || d == SOUTHEAST || d == SOUTHWEST) ? 1 :
+                                           (d == NORTH || d == NORTHWEST || d == NORTHEAST) ? -1 : 0; }
+constexpr bool direction_increases(int d) { return d == EAST || d == SOUTH || d == SOUTHEAST || d == SOUTHWEST; }
+
+/* "ray[d][sq]" is the squares from "sq" (exclusive) to the edge of the
+ * board in direction "d". "between[a][b]" is the squares strictly
+ * between "a" and "b" if they lie on a common rank, file or diagonal,
+ * or zero if they don't. These are computed at compile time. */
+struct RayTables {
+    Bitboard ray[8][100];
+    Bitboard between[100][100];
+
+    constexpr RayTables(): ray(), between() {
+        for (int sq = 0; sq < 100; ++sq) {
+            for (int d = 0; d < 8; ++d) {
+                Bitboard passed = 0;
+                int x = sq % 10 + direction_dx(d);
+                int y = sq / 10 + direction_dy(d);
+                while (0 <= x && x < 10 && 0 <= y && y < 10) {
+                    between[sq][10*y + x] = passed;
+                    passed |= (Bitboard)1 << (10*y + x);
+                    x += direction_dx(d);
+                    y += direction_dy(d);
+                }
+                ray[d][sq] = passed;
+            }
+        }
+    }
+};
+constexpr RayTables RAY_TABLES;
+
+inline Bitboard ray(int d, int sq) { return RAY_TABLES.ray[d][sq]; }
+inline Bitboard between(int a, int b) { return RAY_TABLES.between[a][b]; }
+
+/* The squares reachable from "sq" in direction "d", stopping
+ * short of the first square occupied in "occ". */
+inline Bitboard ray_until_blocked(int d, int sq, Bitboard occ)
+{
+    const Bitboard r = ray(d, sq);
+    const Bitboard blockers = r & occ;
+    if (blockers == 0) return r;
+    const int first = direction_increases(d) ? lowest_square(blockers) : highest_square(blockers);
+    return r & ~ray(d, first) & ~square_bit(first);
+}
+
+/* The squares reachable from "sq" by a rook-like, bishop-like, or
+ * queen-like move, without jumping over anything in "occ". */
+inline Bitboard rook_moves(int sq, Bitboard occ)
+{
+    return ray_until_blocked(EAST, sq, occ) | ray_until_blocked(SOUTH, sq, occ) |
+           ray_until_blocked(WEST, sq, occ) | ray_until_blocked(NORTH, sq, occ);
+}
+inline Bitboard bishop_moves(int sq, Bitboard occ)
+{
+    return ray_until_blocked(SOUTHEAST, sq, occ) | ray_until_blocked(SOUTHWEST, sq, occ) |
+           ray_until_blocked(NORTHWEST, sq, occ) | ray_until_blocked(NORTHEAST, sq, occ);
+}
+inline Bitboard queen_moves(int sq, Bitboard occ)
+{
+    return rook_moves(sq, occ) | bishop_moves(sq, occ);
+}
@@ -1,7 +1,10 @@
 #pragma once
 
+#include <assert.h>
+#include <stdint.h>
 #include <string>
 #include <vector>
+#include "Bitboard.h"
 
 enum Player {
     BLACK, WHITE
@@ -14,11 +17,10 @@ enum Species {
 struct Piece {
     Species type;
     int x, y;
-    bool is_scared;
 
     Piece() { }
     Piece(Species s, int x, int y):
-        type(s), x(x), y(y), is_scared(false)
+        type(s), x(x), y(y)
     { }
 
     bool scares(const Piece &prey) const;
@@ -34,32 +36,144 @@ struct Move {
     int score;
 
     Move() { }
-    Move(const Piece &p, int x, int y);
+    Move(const Piece &p, int x, int y, bool was_scared);
+    bool operator==(const Move &m) const {
+        return from_x == m.from_x && from_y == m.from_y &&
+               to_x == m.to_x && to_y == m.to_y;
+    }
     std::string str() const;
 };
 
+/* A move as the search sees it: just the from- and to-squares,
+ * seven bits each. */
+struct PackedMove {
+    uint16_t bits;
+
+    PackedMove(): bits(0) { }
+    PackedMove(int from, int to): bits((from << 7) | to) { }
+    int from() const { return bits >> 7; }
+    int to() const { return bits & 127; }
+    bool operator==(const PackedMove &m) const { return bits == m.bits; }
+};
+
+/* A list of moves with room for more than any position can have (each
+ * of the six pieces has at most 35 destinations), so that the search
+ * can generate moves without touching the heap. */
+struct MoveList {
+    enum { CAPACITY = 6*35 };
+    PackedMove moves[CAPACITY];
+    int size;
+
+    MoveList(): size(0) { }
+    void push_back(const PackedMove &m) { assert(size < CAPACITY); moves[size++] = m; }
+};
+
+/* How find_best_move() should search. play_barca fills these in
+ * from its command line. */
+struct SearchOptions {
+    int threads;     /* the number of threads to search with */
+    long usec;       /* how long to spend on each move, in microseconds */
+    bool selective;  /* use null-move pruning and late-move reductions */
+    bool mcts;       /* search with Monte Carlo tree search, not alpha-beta */
+
+    SearchOptions(): threads(1), usec(2*1000*1000), selective(true), mcts(false) { }
+};
+extern SearchOptions search_options;
+
 struct Board {
+    /* The pieces, one by one. The UI code works in terms of these;
+     * the search works in terms of the bitboards below, which hold the
+     * same information and are kept in sync by apply_move(). */
     Piece white_pieces[6];
     Piece black_pieces[6];
     Player attacker;
+    uint64_t hash;  /* Zobrist hash of the pieces and the attacker */
+
+    Bitboard pieces_of[2];  /* indexed by Player */
+    Bitboard species[3];    /* indexed by Species */
+    Bitboard scared;
+
+    /* The terms of score(), indexed by Player and kept up to date by
+     * apply_move(), so that score() needn't look at the pieces: the
+     * waterholes each player holds, and the waterholes each player's
+     * pieces have a clear line to (see count_waterhole_threats()). */
+    int waterholes_held[2];
+    int waterhole_threats[2];
 
     int left, right, top, bottom;  /* UI screen measurements */
 
+    /* What unapply_move() needs in order to take back a move. */
+    struct Undo {
+        Bitboard scared;
+        uint64_t hash;
+        int waterhole_threats[2];
+        int piece;  /* index of the moved piece in the mover's array */
+    };
+
     Board();
+    Board(const char *layout, Player attacker);
 
-    bool is_occupied(int x, int y) const;
+    Bitboard occupied() const { return pieces_of[BLACK] | pieces_of[WHITE]; }
+    bool is_occupied(int x, int y) const { return (occupied() & square_bit(x,y)) != 0; }
+    bool is_scared(const Piece &p) const { return (scared & square_bit(p.x,p.y)) != 0; }
+    Species species_at(int sq) const {
+        const Bitboard b = square_bit(sq);
+        return (species[MOUSE] & b) ? MOUSE : (species[LION] & b) ? LION : ELEPHANT;
+    }
     void update_scaredness();
+    void pieces_changed();
+    /* Has somebody (necessarily the defender) got three waterholes? */
+    bool is_won() const { return waterholes_held[BLACK] == 3 || waterholes_held[WHITE] == 3; }
 
     std::vector<Move> find_all_moves() const;
+    void find_all_moves(MoveList &moves) const;
     Move find_best_move() const;
+    bool find_best_move(Move &move, bool (*between_slices)(const Board &)) const;
     Move find_random_move() const;
+    Move unpack(const PackedMove &) const;
     void apply_move(const Move &);
+    void apply_move(const PackedMove &, Undo &undo);
+    void unapply_move(const PackedMove &, const Undo &undo);
+    bool apply_null_move(Undo &undo);
+    void unapply_null_move(const Undo &undo);
     int score() const;
+    void score_moves(const PackedMove *moves, int n, int *values) const;
+    int tactical_value(const PackedMove &) const;
     std::string str() const;
 
   private:
-    void maybe_append_move(std::vector<Move> &moves, const Piece &p, int x, int y) const;
-    void maybe_append_trapped_move(std::vector<Move> &moves, const Piece &p, int x, int y) const;
+    Bitboard scare_zone(Player who, Species prey) const;
+    void append_moves(MoveList &moves, const Piece &p, Bitboard destinations) const;
     bool clear_line_to(const Piece &p, int ax, int ay) const;
-    int waterholes_threatened_by(const Piece &p) const;
+    void count_waterhole_threats(int threats[2]) const;
+    void adjust_waterhole_threats(uint32_t rays, int sign);
+    int score_from_scratch() const;
 };
+
+/* Return the board's value to the defender.
+ * Higher is better for the defender. This just reads off the terms
+ * maintained by apply_move(), and it's inline so that the search can
+ * fold it in; build with -DBARCA_DEBUG_EVAL to check it against
+ * score_from_scratch(). */
+inline int Board::score() const
+{
+    int value;
+    if (waterholes_held[WHITE] == 3) {
+        assert(attacker == BLACK);
+        value = +9999;
+    } else if (waterholes_held[BLACK] == 3) {
+        assert(attacker == WHITE);
+        value = +9999;
+    } else {
+        const int white_scared = popcount(pieces_of[WHITE] & scared);
+        const int black_scared = popcount(pieces_of[BLACK] & scared);
+        const int white_advantage =
+            (10*waterholes_held[WHITE] + waterhole_threats[WHITE] + black_scared) -
+            (10*waterholes_held[BLACK] + waterhole_threats[BLACK] + white_scared);
+        value = (attacker == WHITE) ? -white_advantage : +white_advantage;
+    }
+#ifdef BARCA_DEBUG_EVAL
+    assert(value == this->score_from_scratch());
+#endif
+    return value;
+}
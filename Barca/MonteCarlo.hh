@@ -0,0 +1,386 @@
+#ifndef H_MONTECARLO
+ #define H_MONTECARLO
+
+#include <stddef.h>
+#include <stdint.h>
+#include <assert.h>
+#include <math.h>
+#include <thread>
+#include <vector>
+#include "AlphaBeta.hh"
+
+
+/* A Monte Carlo tree search (UCT), as an alternative to AlphaBeta.
+ * Rather than evaluating positions at a fixed depth, it plays a great
+ * many quick random games ("playouts"), and grows a tree of the positions
+ * it has played through, choosing at each node of the tree the move that
+ * best balances having won often against having been tried rarely. The
+ * move it recommends is the one tried most often from the root.
+ *   A playout stops when the game is over, i.e., when evaluate() is at
+ * least "win" or at most -"win" (a loss or a win for the player to move),
+ * or when there are no moves; or else after "playout_plies" moves, in
+ * which case it's scored by the sign of evaluate(). If the game supplies
+ * classifymove(), each move of a playout is chosen from the forcing moves
+ * half of the time, which makes the playouts rather less aimless.
+ *   With several threads, each one grows its own tree from the same root
+ * ("root parallelism"), and the trees' counts are added up at the end.
+ * The threads share nothing, so this scales with the number of cores;
+ * the game's functions must be safe to call from several threads at once.
+ *   Each tree is kept between calls. If the next call's root is the old
+ * root, or one of its children or grandchildren (e.g., the position after
+ * our move and the opponent's reply), the relevant subtree is reused.
+ *   The game's functions are those of a Hooks class, as for AlphaBeta;
+ * it must supply makemove() and findhash(). */
+template <typename State, typename Move, typename Value, typename Undo, typename Hooks>
+class MonteCarloTreeSearch {
+  public:
+    MonteCarloTreeSearch(Value win, int playout_plies);
+
+    /* Search "st" for "usec" microseconds with "threads" threads, and
+     * set "bestmove". Return false if the attacker has no moves. */
+    bool search(const State &st, int threads, long usec, Move &bestmove);
+
+    /* Throw away all the trees. */
+    void clear() { trees.clear(); }
+
+    /* What the last search() did: the playouts it made (on all threads
+     * together), the number of nodes in all the trees afterward, and how
+     * often the chosen move was tried and how well it did, from 0 (always
+     * lost) to 1 (always won). */
+    struct Stats {
+        unsigned long playouts;
+        unsigned long tree_nodes;
+        unsigned long best_visits;
+        double best_score;
+    };
+    Stats stats;
+
+    /* A tree stops growing once it has this many nodes; its playouts
+     * still count, but no new nodes are added. */
+    enum { MAX_TREE_NODES = 1 << 20 };
+
+  private:
+    /* "score" is the total result of the playouts through this node, for
+     * the player who made "move". The children of a node are stored
+     * together, from "first_child" on; "first_child" is -1 until the
+     * node has been expanded. */
+    struct Node {
+        Move move;
+        int first_child;
+        int num_children;
+        unsigned visits;
+        float score;
+    };
+
+    struct Tree {
+        State root;
+        std::vector<Node> nodes;
+        std::vector<int> path;     /* the nodes visited by this iteration */
+        std::vector<int> movers;   /* who made the move into each of them */
+        std::vector<Move> moves;   /* scratch space for findmoves() */
+        uint64_t rng;
+        unsigned long playouts;
+    };
+    std::vector<Tree> trees;
+
+    Value win;
+    int playout_plies;
+
+    static uint64_t random(uint64_t &rng) {
+        /* xorshift64* */
+        rng ^= rng >> 12;
+        rng ^= rng << 25;
+        rng ^= rng >> 27;
+        return rng * 2685821657736338717ULL;
+    }
+    /* If the game is over in "st", set "result" to its value to player 0
+     * (1 for a win, 0 for a loss, 0.5 for a draw) and return true. */
+    bool is_over(const State &st, float &result) const {
+        const Value v = Hooks::evaluate(st);
+        if (v < win && v > -win)
+          return false;
+        /* evaluate() is from the point of view of the defender. */
+        const int winner = (v > 0) ? 1-Hooks::findattacker(st) : Hooks::findattacker(st);
+        result = (winner == 0) ? 1.0f : 0.0f;
+        return true;
+    }
+
+    void reroot(Tree &t, const State &st);
+    void run(Tree &t, long deadline);
+    void iterate(Tree &t);
+    float playout(Tree &t, State &st);
+    int select(const Tree &t, int node) const;
+};
+
+
+template <typename State, typename Move, typename Value, typename Undo, typename Hooks>
+MonteCarloTreeSearch<State,Move,Value,Undo,Hooks>::MonteCarloTreeSearch(Value w, int plies):
+    win(w), playout_plies(plies)
+{
+    stats.playouts = 0;
+    stats.tree_nodes = 0;
+    stats.best_visits = 0;
+    stats.best_score = 0;
+}
+
+template <typename State, typename Move, typename Value, typename Undo, typename Hooks>
+bool MonteCarloTreeSearch<State,Move,Value,Undo,Hooks>::search(const State &st, int threads,
+                                                               long usec, Move &bestmove)
+{
+    if (threads < 1) threads = 1;
+    if ((int)trees.size() != threads) {
+        trees.resize(threads);
+        for (int i=0; i < threads; ++i) {
+            trees[i].nodes.clear();
+            trees[i].rng = 0x9e3779b97f4a7c15ULL * (i+1) ^ (uint64_t)now_usec();
+        }
+    }
+    for (int i=0; i < threads; ++i) {
+        this->reroot(trees[i], st);
+        trees[i].playouts = 0;
+    }
+    /* Expand the root, so that we know whether there are any moves. */
+    this->iterate(trees[0]);
+    if (trees[0].nodes[0].num_children == 0)
+      return false;
+
+    const long deadline = now_usec() + usec;
+    std::vector<std::thread> helpers;
+    for (int i=1; i < threads; ++i) {
+        helpers.push_back(std::thread([this, i, deadline]() { this->run(trees[i], deadline); }));
+    }
+    this->run(trees[0], deadline);
+    for (int i=0; i < (int)helpers.size(); ++i) {
+        helpers[i].join();
+    }
+
+    /* Add up the visits to each move over all the trees. Each tree
+     * generated the root's moves in the same order, but a tree that
+     * hasn't expanded its root yet has nothing to add. */
+    const Node &root = trees[0].nodes[0];
+    stats.playouts = 0;
+    stats.tree_nodes = 0;
+    stats.best_visits = 0;
+    int best = -1;
+    for (int c=0; c < root.num_children; ++c) {
+        unsigned long visits = 0;
+        double score = 0;
+        for (int i=0; i < threads; ++i) {
+            const Tree &t = trees[i];
+            if (t.nodes[0].num_children != root.num_children)
+              continue;
+            const Node &child = t.nodes[t.nodes[0].first_child + c];
+            assert(child.move == trees[0].nodes[root.first_child + c].move);
+            visits += child.visits;
+            score += child.score;
+        }
+        if (best == -1 || visits > stats.best_visits) {
+            best = c;
+            stats.best_visits = visits;
+            stats.best_score = visits ? score / visits : 0;
+        }
+    }
+    for (int i=0; i < threads; ++i) {
+        stats.playouts += trees[i].playouts;
+        stats.tree_nodes += trees[i].nodes.size();
+    }
+    bestmove = trees[0].nodes[root.first_child + best].move;
+    return true;
+}
+
+/* Make "st" the root of "t", keeping whatever part of the tree
+ * we can. */
+template <typename State, typename Move, typename Value, typename Undo, typename Hooks>
+void MonteCarloTreeSearch<State,Move,Value,Undo,Hooks>::reroot(Tree &t, const State &st)
+{
+    const uint64_t key = Hooks::findhash(st);
+    int keep = -1;
+    if (!t.nodes.empty()) {
+        if (Hooks::findhash(t.root) == key) {
+            keep = 0;
+        } else {
+            const Node &root = t.nodes[0];
+            for (int c = root.first_child; keep == -1 && c >= 0 && c < root.first_child + root.num_children; ++c) {
+                State child = t.root;
+                Undo undo;
+                Hooks::makemove(child, t.nodes[c].move, undo);
+                if (Hooks::findhash(child) == key) {
+                    keep = c;
+                    break;
+                }
+                const Node &n = t.nodes[c];
+                for (int g = n.first_child; g >= 0 && g < n.first_child + n.num_children; ++g) {
+                    State grandchild = child;
+                    Hooks::makemove(grandchild, t.nodes[g].move, undo);
+                    if (Hooks::findhash(grandchild) == key) {
+                        keep = g;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+    t.root = st;
+    if (keep == 0)
+      return;
+
+    std::vector<Node> kept;
+    if (keep > 0) {
+        /* Copy the subtree breadth-first, so that each node's children
+         * still end up together. */
+        kept.reserve(MAX_TREE_NODES);
+        kept.push_back(t.nodes[keep]);
+        for (int i=0; i < (int)kept.size(); ++i) {
+            Node &n = kept[i];
+            if (n.first_child < 0) continue;
+            const int first = n.first_child;
+            n.first_child = kept.size();
+            for (int c=0; c < n.num_children; ++c) {
+                kept.push_back(t.nodes[first + c]);
+            }
+        }
+    } else {
+        kept.reserve(MAX_TREE_NODES);
+        Node root;
+        root.first_child = -1;
+        root.num_children = 0;
+        root.visits = 0;
+        root.score = 0;
+        kept.push_back(root);
+    }
+    t.nodes.swap(kept);
+}
+
+template <typename State, typename Move, typename Value, typename Undo, typename Hooks>
+void MonteCarloTreeSearch<State,Move,Value,Undo,Hooks>::run(Tree &t, long deadline)
+{
+    /* Looking at the clock costs about as much as a few moves of a
+     * playout, so only look every so often. */
+    do {
+        for (int i=0; i < 16; ++i) {
+            this->iterate(t);
+        }
+    } while (now_usec() < deadline);
+}
+
+/* Walk down the tree to a leaf, choosing moves by select(); expand the
+ * leaf if it's been visited before; play out a game from there; and
+ * credit the result to every node on the way. */
+template <typename State, typename Move, typename Value, typename Undo, typename Hooks>
+void MonteCarloTreeSearch<State,Move,Value,Undo,Hooks>::iterate(Tree &t)
+{
+    State st = t.root;
+    Undo undo;
+    int node = 0;
+    t.path.clear();
+    t.movers.clear();
+    t.path.push_back(0);
+    t.movers.push_back(-1);
+    float result;
+    bool over = false;
+    while (t.nodes[node].first_child >= 0 && t.nodes[node].num_children > 0) {
+        node = this->select(t, node);
+        t.movers.push_back(Hooks::findattacker(st));
+        Hooks::makemove(st, t.nodes[node].move, undo);
+        t.path.push_back(node);
+        if (this->is_over(st, result)) {
+            over = true;
+            break;
+        }
+    }
+    if (!over && t.nodes[node].first_child < 0 &&
+        (node == 0 || t.nodes[node].visits > 0)) {
+        t.moves.clear();
+        Hooks::findmoves(st, t.moves);
+        const int n = t.moves.size();
+        if (t.nodes.size() + n <= (size_t)MAX_TREE_NODES) {
+            t.nodes[node].first_child = t.nodes.size();
+            t.nodes[node].num_children = n;
+            for (int i=0; i < n; ++i) {
+                Node child;
+                child.move = t.moves[i];
+                child.first_child = -1;
+                child.num_children = 0;
+                child.visits = 0;
+                child.score = 0;
+                t.nodes.push_back(child);
+            }
+            if (n > 0) {
+                node = t.nodes[node].first_child + random(t.rng) % n;
+                t.movers.push_back(Hooks::findattacker(st));
+                Hooks::makemove(st, t.nodes[node].move, undo);
+                t.path.push_back(node);
+            }
+        }
+    }
+    if (!over)
+      result = this->playout(t, st);
+    t.playouts += 1;
+    for (int i=0; i < (int)t.path.size(); ++i) {
+        Node &n = t.nodes[t.path[i]];
+        n.visits += 1;
+        n.score += (t.movers[i] == 0) ? result : 1.0f - result;
+    }
+}
+
+/* The UCT rule: the child with the best average score plus a bonus for
+ * being tried less often than its siblings. Untried children come first. */
+template <typename State, typename Move, typename Value, typename Undo, typename Hooks>
+int MonteCarloTreeSearch<State,Move,Value,Undo,Hooks>::select(const Tree &t, int node) const
+{
+    const Node &n = t.nodes[node];
+    const float log_visits = logf((float)n.visits + 1);
+    int best = -1;
+    float best_uct = -1;
+    for (int c = n.first_child; c < n.first_child + n.num_children; ++c) {
+        const Node &child = t.nodes[c];
+        if (child.visits == 0)
+          return c;
+        const float uct = child.score / child.visits + 0.7f * sqrtf(log_visits / child.visits);
+        if (uct > best_uct) {
+            best_uct = uct;
+            best = c;
+        }
+    }
+    return best;
+}
+
+/* Play random moves from "st" until the game is over or we've played
+ * "playout_plies" of them, and return the result for player 0. */
+template <typename State, typename Move, typename Value, typename Undo, typename Hooks>
+float MonteCarloTreeSearch<State,Move,Value,Undo,Hooks>::playout(Tree &t, State &st)
+{
+    Undo undo;
+    float result;
+    for (int ply = 0; ply < playout_plies; ++ply) {
+        if (this->is_over(st, result))
+          return result;
+        t.moves.clear();
+        Hooks::findmoves(st, t.moves);
+        const int n = t.moves.size();
+        if (n == 0)
+          break;
+        const uint64_t r = random(t.rng);
+        int pick = (r >> 1) % n;
+        if (Hooks::has_classifier() && (r & 1)) {
+            /* Pick the first forcing move after a random starting point. */
+            for (int i=0; i < n; ++i) {
+                const int j = (pick + i) % n;
+                if (Hooks::classifymove(st, t.moves[j]) > 0) {
+                    pick = j;
+                    break;
+                }
+            }
+        }
+        Hooks::makemove(st, t.moves[pick], undo);
+    }
+    if (this->is_over(st, result))
+      return result;
+    const Value v = Hooks::evaluate(st);
+    const int defender = 1-Hooks::findattacker(st);
+    if (v == 0)
+      return 0.5f;
+    return ((v > 0) == (defender == 0)) ? 1.0f : 0.0f;
+}
+
+#endif /* H_MONTECARLO */
@@ -0,0 +1,331 @@
+#ifndef H_PROOFNUMBER
+ #define H_PROOFNUMBER
+
+#include <stddef.h>
+#include <stdint.h>
+#include <assert.h>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include "AlphaBeta.hh"
+
+
+/* A depth-first proof-number search ("df-pn"), which tries to prove that
+ * the attacker can force a win, and doesn't care by how much. Where
+ * alpha-beta looks at every move to a fixed depth, this follows whichever
+ * line looks cheapest to settle: a position in which the defender has
+ * only a few replies (e.g., because all he can do is rescue a scared
+ * piece) needs only those few replies refuted, so forcing lines get
+ * searched far deeper than anything else.
+ *   Each position has a proof number and a disproof number: roughly, how
+ * many more positions must be settled to prove that the player to move
+ * there wins, or that he doesn't. They are kept from the mover's point
+ * of view ("phi" and "delta"), in a table keyed by the State's hash, so
+ * that transpositions are settled only once, and so are positions
+ * solved by earlier calls.
+ *   A position is over if evaluate() is at least "win" or at most -"win"
+ * (a loss or a win, respectively, for the player to move), or if there
+ * are no moves, which is a loss for the player to move. A repetition of
+ * a position earlier in the line being searched, or a line longer than
+ * MAX_DEPTH plies, counts as a draw, and a draw counts as a loss for
+ * whoever is trying to prove the win. So a proof can be trusted, but a
+ * disproof may just mean that the win lies beyond what we'll look at,
+ * or behind a repetition of a position that a later call won't have
+ * passed through; so disproofs are kept only for the rest of the call
+ * that found them, while proofs are kept for good.
+ *   If the game supplies classifymove(), the prover considers only his
+ * forcing moves (those it classifies as positive), while the defender
+ * still gets to try everything. Any win this finds is still a win, and
+ * it's found much sooner; but it'll miss a win that takes a quiet move.
+ *   The game's functions are those of a Hooks class, as for AlphaBeta;
+ * it must supply makemove(), unmakemove() and findhash(). */
+template <typename State, typename Move, typename Value, typename Undo, typename Hooks>
+class ProofNumberSearch {
+  public:
+    enum Result { PROVEN, DISPROVEN, UNKNOWN };
+
+    /* The table will have 2**log2_entries entries. */
+    ProofNumberSearch(int log2_entries, Value win);
+
+    /* Try to prove that the attacker in "st" can force a win, applying
+     * at most "maxnodes" moves in the attempt. If he can, set
+     * "winning_move" to the first move of the win and return PROVEN. */
+    Result prove(const State &st, unsigned long maxnodes, Move &winning_move);
+
+    /* Forget everything, including the positions already solved. */
+    void clear();
+
+    /* While "flag" is non-NULL, prove() checks it at every node, and
+     * gives up (returning UNKNOWN) once it becomes true. */
+    void set_stop_flag(const std::atomic<bool> *flag) { stop = flag; }
+
+    /* The number of positions prove() has searched. It is never reset
+     * automatically. */
+    unsigned long nodes;
+
+    enum { MAX_DEPTH = 64 };
+
+  private:
+    typedef uint32_t Number;
+    static constexpr Number INFINITE = 0x3fffffff;
+    static Number add(Number a, Number b) { return (a + b >= INFINITE) ? INFINITE : a + b; }
+
+    struct Entry {
+        uint64_t key;
+        Number phi, delta;
+        uint32_t disproved_in;  /* the call that disproved it, or 0 */
+    };
+    std::vector<Entry> table;
+    uint64_t mask;
+    uint32_t calls;  /* how many times prove() has been called */
+    bool lookup(uint64_t key, Number &phi, Number &delta) const;
+    void store(uint64_t key, int mover, Number phi, Number delta);
+
+    /* For the node being searched at each height: its moves, and what we
+     * know of each one's result, from the point of view of the player
+     * making it. */
+    struct Children {
+        std::vector<Move> moves;
+        std::vector<Number> phi, delta;
+    };
+    std::deque<Children> children;
+
+    std::vector<uint64_t> path;  /* the hashes of the line being searched */
+    int prover;                  /* the attacker at the root */
+    unsigned long budget;        /* stop when "nodes" reaches this */
+    const std::atomic<bool> *stop;
+    Value win;
+
+    /* If the game is over in "st", set "phi" and "delta" and return true. */
+    bool is_over(const State &st, Number &phi, Number &delta) const {
+        const Value v = Hooks::evaluate(st);
+        if (v < win && v > -win)
+          return false;
+        phi = (v > 0) ? INFINITE : 0;
+        delta = (v > 0) ? 0 : INFINITE;
+        return true;
+    }
+
+    /* Since draws count against the prover, what we learn while proving
+     * a win for one player doesn't hold when proving a win for the
+     * other; so the two keep their results apart in the table. */
+    uint64_t hash(const State &st) const {
+        return Hooks::findhash(st) ^ (prover ? 0x9e3779b97f4a7c15ULL : 0);
+    }
+    void draw(int mover, Number &phi, Number &delta) const {
+        phi = (mover == prover) ? INFINITE : 0;
+        delta = (mover == prover) ? 0 : INFINITE;
+    }
+    bool out_of_time() const {
+        return nodes >= budget || (stop != NULL && stop->load(std::memory_order_relaxed));
+    }
+    void mid(State &st, int height, Number thphi, Number thdelta, Number &phi, Number &delta);
+};
+
+
+template <typename State, typename Move, typename Value, typename Undo, typename Hooks>
+ProofNumberSearch<State,Move,Value,Undo,Hooks>::ProofNumberSearch(int log2_entries, Value w):
+    nodes(0), table((size_t)1 << log2_entries), mask(((uint64_t)1 << log2_entries) - 1),
+    calls(0), prover(0), budget(0), stop(NULL), win(w)
+{
+    this->clear();
+}
+
+template <typename State, typename Move, typename Value, typename Undo, typename Hooks>
+void ProofNumberSearch<State,Move,Value,Undo,Hooks>::clear()
+{
+    for (size_t i=0; i < table.size(); ++i) {
+        table[i].key = 0;
+        table[i].phi = table[i].delta = 0;
+        table[i].disproved_in = 0;
+    }
+}
+
+template <typename State, typename Move, typename Value, typename Undo, typename Hooks>
+bool ProofNumberSearch<State,Move,Value,Undo,Hooks>::lookup(uint64_t key, Number &phi, Number &delta) const
+{
+    const Entry &e = table[key & mask];
+    if (e.key != key || (e.phi == 0 && e.delta == 0))
+      return false;
+    if (e.disproved_in != 0 && e.disproved_in != calls)
+      return false;
+    phi = e.phi;
+    delta = e.delta;
+    return true;
+}
+
+/* Each key has only one slot, and a newer entry evicts an older one,
+ * except that a position that's been solved is kept in preference to
+ * one that hasn't (unless it's a disproof from an earlier call). */
+template <typename State, typename Move, typename Value, typename Undo, typename Hooks>
+void ProofNumberSearch<State,Move,Value,Undo,Hooks>::store(uint64_t key, int mover,
+                                                     Number phi, Number delta)
+{
+    Entry &e = table[key & mask];
+    const bool solved = (phi == 0 || delta == 0);
+    const bool was_solved = ((e.phi == 0) != (e.delta == 0)) &&
+                            (e.disproved_in == 0 || e.disproved_in == calls);
+    if (was_solved && !solved && e.key != key)
+      return;
+    /* phi and delta are from the mover's point of view, so the prover
+     * has lost if he's to move and can't win, or if the defender can. */
+    const bool disproved = (mover == prover) ? (delta == 0) : (phi == 0);
+    e.key = key;
+    e.phi = phi;
+    e.delta = delta;
+    e.disproved_in = disproved ? calls : 0;
+}
+
+template <typename State, typename Move, typename Value, typename Undo, typename Hooks>
+typename ProofNumberSearch<State,Move,Value,Undo,Hooks>::Result
+ProofNumberSearch<State,Move,Value,Undo,Hooks>::prove(const State &st, unsigned long maxnodes,
+                                                Move &winning_move)
+{
+    State root = st;
+    prover = Hooks::findattacker(root);
+    budget = nodes + maxnodes;
+    /* A new call number expires the old disproofs; 0 means "none". */
+    calls += 1;
+    if (calls == 0) {
+        this->clear();
+        calls = 1;
+    }
+    path.clear();
+    Number phi, delta;
+    this->mid(root, 0, INFINITE, INFINITE, phi, delta);
+    if (phi != 0)
+      return (delta == 0) ? DISPROVEN : UNKNOWN;
+    /* The winning move is one that leads to a position proven for us.
+     * (If the root was solved by an earlier call, mid() didn't even
+     * look at its moves.) */
+    std::vector<Move> moves;
+    Hooks::findmoves(root, moves);
+    for (int i=0; i < (int)moves.size(); ++i) {
+        Undo undo;
+        Hooks::makemove(root, moves[i], undo);
+        Number cphi, cdelta;
+        const bool found = this->is_over(root, cphi, cdelta) ||
+                           lookup(this->hash(root), cphi, cdelta);
+        const bool ours = (Hooks::findattacker(root) == prover);
+        Hooks::unmakemove(root, moves[i], undo);
+        if (found && (ours ? cphi : cdelta) == 0) {
+            winning_move = moves[i];
+            return PROVEN;
+        }
+    }
+    /* The proof has been evicted from under us. */
+    return UNKNOWN;
+}
+
+/* Search "st" until its proof number reaches "thphi" or its disproof
+ * number reaches "thdelta" (or we run out of nodes), and return both.
+ * This is the "multiple iterative deepening" of Nagai's df-pn. */
+template <typename State, typename Move, typename Value, typename Undo, typename Hooks>
+void ProofNumberSearch<State,Move,Value,Undo,Hooks>::mid(State &st, int height,
+                                                   Number thphi, Number thdelta,
+                                                   Number &phi, Number &delta)
+{
+    const int mover = Hooks::findattacker(st);
+    if (height >= MAX_DEPTH) {
+        this->draw(mover, phi, delta);
+        return;
+    }
+    const uint64_t key = this->hash(st);
+    if (lookup(key, phi, delta) && (phi >= thphi || delta >= thdelta))
+      return;
+    if (this->is_over(st, phi, delta))
+      return;
+
+    while ((int)children.size() <= height)
+      children.push_back(Children());
+    Children &c = children[height];
+    c.moves.clear();
+    Hooks::findmoves(st, c.moves);
+    if (c.moves.empty()) {
+        phi = INFINITE;
+        delta = 0;
+        store(key, mover, phi, delta);
+        return;
+    }
+    /* The prover needs only one winning move, so we can choose which to
+     * look at: just the forcing ones, which keep the defender busy. */
+    if (mover == prover && Hooks::has_classifier()) {
+        int kept = 0;
+        for (int i=0; i < (int)c.moves.size(); ++i) {
+            if (Hooks::classifymove(st, c.moves[i]) > 0)
+              c.moves[kept++] = c.moves[i];
+        }
+        c.moves.resize(kept);
+        if (kept == 0) {
+            phi = INFINITE;
+            delta = 0;
+            store(key, mover, phi, delta);
+            return;
+        }
+    }
+
+    /* What do we know about each move already? Moves back to a position
+     * on the current line count as draws, and so are never searched. */
+    const int n = c.moves.size();
+    c.phi.resize(n);
+    c.delta.resize(n);
+    for (int i=0; i < n; ++i) {
+        Undo undo;
+        Hooks::makemove(st, c.moves[i], undo);
+        const uint64_t ckey = this->hash(st);
+        const int cmover = Hooks::findattacker(st);
+        Number cphi = 1, cdelta = 1;
+        if (std::find(path.begin(), path.end(), ckey) != path.end() || ckey == key)
+          this->draw(cmover, cphi, cdelta);
+        else if (!this->is_over(st, cphi, cdelta))
+          lookup(ckey, cphi, cdelta);
+        Hooks::unmakemove(st, c.moves[i], undo);
+        c.phi[i] = (cmover == mover) ? cphi : cdelta;
+        c.delta[i] = (cmover == mover) ? cdelta : cphi;
+    }
+
+    path.push_back(key);
+    while (true) {
+        /* We win if any move wins, and lose only if every move loses. */
+        int best = 0;
+        Number second = INFINITE;
+        phi = INFINITE;
+        delta = 0;
+        for (int i=0; i < n; ++i) {
+            delta = add(delta, c.delta[i]);
+            if (c.phi[i] < phi) {
+                second = phi;
+                phi = c.phi[i];
+                best = i;
+            } else if (c.phi[i] < second) {
+                second = c.phi[i];
+            }
+        }
+        if (phi >= thphi || delta >= thdelta || this->out_of_time())
+          break;
+
+        /* Search the most promising move until either it stops being the
+         * most promising, or this node would reach its own thresholds. */
+        const Number tphi = std::min(thphi, add(second, 1));
+        const Number tdelta = thdelta - delta + c.delta[best];
+        const Move move = c.moves[best];
+        Undo undo;
+        Hooks::makemove(st, move, undo);
+        this->nodes += 1;
+        const bool same = (Hooks::findattacker(st) == mover);
+        Number cphi, cdelta;
+        if (same)
+          this->mid(st, height+1, tphi, tdelta, cphi, cdelta);
+        else
+          this->mid(st, height+1, tdelta, tphi, cphi, cdelta);
+        Hooks::unmakemove(st, move, undo);
+        /* "children" may have grown, but being a deque, it didn't move "c". */
+        c.phi[best] = same ? cphi : cdelta;
+        c.delta[best] = same ? cdelta : cphi;
+    }
+    path.pop_back();
+    store(key, mover, phi, delta);
+}
+
+#endif /* H_PROOFNUMBER */
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "AlphaBeta.hh"
+#include "ProofNumber.hh"
+#include "MonteCarlo.hh"
+#include "Board.h"
+
+/* How the search sees a Board. These are static and inline, so that the
+ * compiler can fold them into the search loop instead of calling through
+ * function pointers. */
+struct BarcaHooks : AlphaBetaHooks<Board, PackedMove, int, Board::Undo> {
+    static bool has_makemove() { return true; }
+    static bool has_hash() { return true; }
+    static bool has_classifier() { return true; }
+    static bool has_indexer() { return true; }
+    static bool has_nullmove() { return true; }
+
+    static int evaluate(const Board &board) { return board.score(); }
+    static void makemove(Board &board, const PackedMove &move, Board::Undo &undo) {
+        board.apply_move(move, undo);
+    }
+    static void unmakemove(Board &board, const PackedMove &move, const Board::Undo &undo) {
+        board.unapply_move(move, undo);
+    }
+    static bool makenullmove(Board &board, Board::Undo &undo) { return board.apply_null_move(undo); }
+    static void unmakenullmove(Board &board, const Board::Undo &undo) { board.unapply_null_move(undo); }
+    /* The engine hands us the same vector at the same height every time,
+     * so once it has grown big enough, this doesn't allocate. */
+    static void findmoves(const Board &board, std::vector<PackedMove> &allmoves) {
+        MoveList moves;
+        board.find_all_moves(moves);
+        allmoves.assign(moves.moves, moves.moves + moves.size);
+    }
+    static int findattacker(const Board &board) { return board.attacker; }
+    static uint64_t findhash(const Board &board) { return board.hash; }
+    static int classifymove(const Board &board, const PackedMove &move) {
+        return board.tactical_value(move);
+    }
+    static int indexmove(const PackedMove &move) { return 100*move.from() + move.to(); }
+    /* Every move hands the turn over, so a move's value to the mover is
+     * the score() of the board after it. */
+    static bool has_batch_evaluator() { return true; }
+    static void evaluatemoves(const Board &board, const PackedMove *moves, int n, int *values) {
+        board.score_moves(moves, n, values);
+    }
+};
+
+/* indexmove() returns less than this. */
+const int BARCA_HISTORY_SIZE = 100*100;
+
+/* How far past the horizon find_best_move() follows forcing moves:
+ * moves onto waterholes, scaring moves, and escapes (see
+ * Board::tactical_value()). */
+const int BARCA_QUIESCENCE_PLIES = 4;
+
+typedef AlphaBeta<Board, PackedMove, int, Board::Undo, BarcaHooks> BarcaSearch;
+typedef AnytimeSearch<Board, PackedMove, int, Board::Undo, BarcaHooks> BarcaAnytimeSearch;
+typedef ProofNumberSearch<Board, PackedMove, int, Board::Undo, BarcaHooks> BarcaProofSearch;
+typedef MonteCarloTreeSearch<Board, PackedMove, int, Board::Undo, BarcaHooks> BarcaMonteCarlo;
+
+/* The engine used by find_best_move(), and its transposition table. */
+extern TranspositionTable<PackedMove, int> tt;
+extern BarcaSearch ab;
+
+/* Before searching, find_best_move() spends up to this many nodes
+ * (a few tenths of a second) looking for a forced win with "solver". */
+extern BarcaProofSearch solver;
+const unsigned long BARCA_PROOF_NODES = 50*1000;
+
+/* The engine find_best_move() uses instead of "ab" if search_options.mcts
+ * is set. Its playouts are this long. */
+extern BarcaMonteCarlo mcts;
+const int BARCA_PLAYOUT_PLIES = 20;
+
+/* Searches the opponent's position in a background thread while the
+ * opponent thinks about it, using "ab" itself, so that by the time it's
+ * our turn the transposition table, history and killers are already
+ * full of results about the position we're likely to face. Nothing
+ * else may use "ab" between start() and stop(). */
+class Ponderer {
+  public:
+    Ponderer(): running(false), completed(0) { }
+    ~Ponderer() { this->stop(); }
+
+    /* Start searching "board", on which it's the opponent's turn,
+     * stopping whatever we were pondering before. */
+    void start(const Board &board);
+    void stop();
+    /* Are we pondering exactly this position? */
+    bool is_pondering(const Board &board) const;
+
+    /* If "board" is what we pondered, after the opponent's move that
+     * we expected, and we got far enough to have searched our reply as
+     * deeply as find_best_move() got on our previous turn, set "reply"
+     * and return true. Call this only after stop(). */
+    bool predicted_reply(const Board &board, Move &reply) const;
+
+  private:
+    std::thread thread;
+    std::atomic<bool> stop_flag;
+    bool running;
+    Board root;
+    int completed;  /* the deepest iteration completed */
+    std::vector<PackedMove> pv;
+};
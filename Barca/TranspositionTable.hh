@@ -0,0 +1,184 @@
+
+#ifndef H_TRANSPOSITIONTABLE
+ #define H_TRANSPOSITIONTABLE
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <atomic>
+#include <vector>
+
+
+/* A fixed-size hash table remembering the results of previous searches,
+ * keyed by a 64-bit hash of the State (e.g., a Zobrist hash). The table
+ * is divided into buckets of a few entries each; a key can live only in
+ * the bucket selected by its low bits, so lookups touch a single cache
+ * line or two, and the table never grows. When a bucket is full, we
+ * evict the entry from the oldest search, or failing that the entry
+ * searched to the shallowest depth.
+ *   Several threads may probe and store at once, without locking. Each
+ * slot holds its entry as a few 64-bit words, plus the key XORed with all
+ * of those words. If two threads' stores to the same slot interleave, the
+ * words won't match the check word any more, and the torn entry will be
+ * treated as missing. This requires Move and Value to be trivially
+ * copyable.
+ */
+template<typename Move, typename Value>
+class TranspositionTable {
+  public:
+    /* EXACT: the stored value is the true value of the position.
+     * LOWER: the search failed high; the true value is at least this.
+     * UPPER: the search failed low; the true value is at most this. */
+    enum Bound { EXACT, LOWER, UPPER };
+
+    struct Entry {
+        Move move;      // the best move found, or the move that cut off
+        Value value;    // the value to the attacker, from AlphaBeta's point of view
+        short depth;    // how many plies deep this position was searched
+        unsigned char bound;
+        unsigned char generation;
+    };
+
+    /* The table will have 2**log2_buckets buckets. */
+    explicit TranspositionTable(int log2_buckets);
+
+    /* If this key is in the table, copy its entry into "e" and return true. */
+    bool probe(uint64_t key, Entry &e) const;
+    void store(uint64_t key, int depth, Bound bound, Value value, const Move &move);
+
+    /* Mark everything currently in the table as "old", so that it'll be
+     * preferentially evicted by entries from the upcoming search. This
+     * and clear() must not be called while any thread is searching. */
+    void new_search() { generation += 1; }
+    void clear();
+
+  private:
+    enum { ENTRIES_PER_BUCKET = 4 };
+    enum { DATA_WORDS = (sizeof(Entry) + 7) / 8 };
+    struct Slot {
+        std::atomic<uint64_t> check;  // the key, XORed with all the data words
+        std::atomic<uint64_t> data[DATA_WORDS];
+    };
+    struct Bucket {
+        Slot slots[ENTRIES_PER_BUCKET];
+    };
+    std::vector<Bucket> buckets;
+    uint64_t mask;
+    unsigned char generation;
+
+    /* Read a slot's entry, and return the key it was stored under
+     * (or garbage, if the slot is torn). */
+    static uint64_t read_slot(const Slot &slot, Entry &e);
+    static void write_slot(Slot &slot, uint64_t key, const Entry &e);
+};
+
+
+template <typename Move, typename Value>
+TranspositionTable<Move,Value>::TranspositionTable(int log2_buckets):
+    buckets((size_t)1 << log2_buckets),
+    mask(((uint64_t)1 << log2_buckets) - 1),
+    generation(0)
+{
+    assert(0 < log2_buckets && log2_buckets < 32);
+    this->clear();
+}
+
+template <typename Move, typename Value>
+void TranspositionTable<Move,Value>::clear()
+{
+    Entry empty = Entry();
+    /* A depth of -1 marks an empty slot. */
+    empty.depth = -1;
+    for (size_t i=0; i < buckets.size(); ++i) {
+        for (int j=0; j < ENTRIES_PER_BUCKET; ++j) {
+            write_slot(buckets[i].slots[j], 0, empty);
+        }
+    }
+    generation = 0;
+}
+
+template <typename Move, typename Value>
+uint64_t TranspositionTable<Move,Value>::read_slot(const Slot &slot, Entry &e)
+{
+    uint64_t words[DATA_WORDS];
+    uint64_t key = slot.check.load(std::memory_order_relaxed);
+    for (int k=0; k < DATA_WORDS; ++k) {
+        words[k] = slot.data[k].load(std::memory_order_relaxed);
+        key ^= words[k];
+    }
+    memcpy(&e, words, sizeof e);
+    return key;
+}
+
+template <typename Move, typename Value>
+void TranspositionTable<Move,Value>::write_slot(Slot &slot, uint64_t key, const Entry &e)
+{
+    uint64_t words[DATA_WORDS] = {};
+    memcpy(words, &e, sizeof e);
+    uint64_t check = key;
+    for (int k=0; k < DATA_WORDS; ++k) {
+        slot.data[k].store(words[k], std::memory_order_relaxed);
+        check ^= words[k];
+    }
+    slot.check.store(check, std::memory_order_relaxed);
+}
+
+template <typename Move, typename Value>
+bool TranspositionTable<Move,Value>::probe(uint64_t key, Entry &e) const
+{
+    const Bucket &b = buckets[key & mask];
+    for (int j=0; j < ENTRIES_PER_BUCKET; ++j) {
+        if (read_slot(b.slots[j], e) == key && e.depth >= 0)
+          return true;
+    }
+    return false;
+}
+
+template <typename Move, typename Value>
+void TranspositionTable<Move,Value>::store(uint64_t key, int depth, Bound bound,
+                                           Value value, const Move &move)
+{
+    assert(depth >= 0);
+    Bucket &b = buckets[key & mask];
+    Entry entries[ENTRIES_PER_BUCKET];
+    uint64_t keys[ENTRIES_PER_BUCKET];
+    int victim = -1;
+    for (int j=0; j < ENTRIES_PER_BUCKET; ++j) {
+        keys[j] = read_slot(b.slots[j], entries[j]);
+        if (keys[j] == key && entries[j].depth >= 0) {
+            /* Never replace a deeper result for the same position with a
+             * shallower one from the same search. */
+            if (entries[j].depth > depth && entries[j].generation == generation)
+              return;
+            victim = j;
+            goto found_victim;
+        }
+    }
+    for (int j=0; j < ENTRIES_PER_BUCKET; ++j) {
+        const Entry &e = entries[j];
+        if (e.depth < 0) {
+            victim = j;
+            break;
+        }
+        /* Otherwise, prefer to evict entries from older searches,
+         * and then entries searched to a shallower depth. */
+        const bool e_old = (e.generation != generation);
+        const bool v_old = (victim != -1 && entries[victim].generation != generation);
+        if (victim == -1 || (e_old && !v_old) ||
+            (e_old == v_old && e.depth < entries[victim].depth)) {
+            victim = j;
+        }
+    }
+  found_victim:
+    assert(victim != -1);
+    Entry e = Entry();
+    e.move = move;
+    e.value = value;
+    e.depth = depth;
+    e.bound = bound;
+    e.generation = generation;
+    write_slot(b.slots[victim], key, e);
+}
+
+#endif /* H_TRANSPOSITIONTABLE */
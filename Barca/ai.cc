@@ -1,35 +1,105 @@
 #include <assert.h>
+#include <ctype.h>
 #include <stdio.h>
 #include <string.h>
-#include <sys/time.h>
 #include <algorithm>
 #include <string>
 #include <vector>
-#include "AlphaBeta.hh"
 #include "Board.h"
+#include "Search.h"
 
-static int ab_evaluate(const Board &board)
-{
-    return board.score();
-}
+/* The search stops at this depth even if there's time left over. */
+static const int MAX_PLY = 64;
+
+/* find_best_move() can let its caller poll the screen this often. */
+static const long SLICE_USEC = 250*1000;
+
+/* Each iteration of the search first looks for a value within this
+ * distance of its expected value (one waterhole is worth 10 points). */
+static const int ASPIRATION_WINDOW = 5;
+
+SearchOptions search_options;
+
+/* 2**18 buckets of 4 entries each. */
+TranspositionTable<PackedMove, int> tt(18);
+
+BarcaSearch ab(&tt, BARCA_HISTORY_SIZE);
 
-static void ab_apply(Board &board, const Move &move)
+/* 2**20 entries; a score of 9999 means somebody has won. */
+BarcaProofSearch solver(20, 9999);
+
+BarcaMonteCarlo mcts(9999, BARCA_PLAYOUT_PLIES);
+
+/* How deep find_best_move() got last time; Ponderer::predicted_reply()
+ * needs a reply searched at least this deeply. */
+static int last_search_depth = 0;
+
+/* Random numbers for Zobrist hashing: one for each kind of piece on each
+ * square, plus one that's XORed in when it's White's turn. */
+struct ZobristKeys {
+    uint64_t pieces[2][3][100];
+    uint64_t white_to_move;
+
+    ZobristKeys() {
+        /* A fixed-seed xorshift generator, so that hashes are the same
+         * from run to run. */
+        uint64_t r = 0x9E3779B97F4A7C15ull;
+        for (int p=0; p < 2; ++p) {
+            for (int s=0; s < 3; ++s) {
+                for (int sq=0; sq < 100; ++sq) {
+                    pieces[p][s][sq] = next(r);
+                }
+            }
+        }
+        white_to_move = next(r);
+    }
+
+    static uint64_t next(uint64_t &r) {
+        r ^= r << 13;
+        r ^= r >> 7;
+        r ^= r << 17;
+        return r;
+    }
+};
+
+static const ZobristKeys &zobrist()
 {
-    board.apply_move(move);
+    static const ZobristKeys keys;
+    return keys;
 }
 
-void ab_findmoves(const Board &board, std::vector<Move> &allmoves)
+static uint64_t zobrist_key(Player who, const Piece &p)
 {
-    allmoves = board.find_all_moves();
+    return zobrist().pieces[who][p.type][10*p.y + p.x];
 }
 
-int ab_findattacker(const Board &board)
+/* The waterholes, in the order used to number the rays in WaterholeRays. */
+static const int waterhole_squares[4] = { 33, 36, 63, 66 };
+
+/* "through[sq]" has bit 8*h+d set if square "sq" lies on the ray from
+ * waterhole number "h" in direction "d"; a piece moving to or from "sq"
+ * can change which piece is the first one met along that ray. */
+struct WaterholeRays {
+    uint32_t through[100];
+
+    WaterholeRays(): through() {
+        for (int h=0; h < 4; ++h) {
+            for (int d=0; d < 8; ++d) {
+                Bitboard r = ray(d, waterhole_squares[h]);
+                while (r != 0) {
+                    through[pop_lowest_square(r)] |= (uint32_t)1 << (8*h + d);
+                }
+            }
+        }
+    }
+};
+
+static const WaterholeRays &waterhole_rays()
 {
-    return board.attacker;
+    static const WaterholeRays rays;
+    return rays;
 }
 
-AlphaBeta<Board, Move, int> ab(ab_evaluate, ab_apply, ab_findmoves, ab_findattacker);
-
 Board::Board()
 {
     /* Assume that the human player takes South, and moves first. */
@@ -49,15 +119,62 @@ Board::Board()
     black_pieces[3] = Piece(MOUSE, 4,8);
     black_pieces[4] = Piece(MOUSE, 5,8);
     black_pieces[5] = Piece(LION, 6,8);
+
+    this->pieces_changed();
 }
 
-bool Board::is_occupied(int x, int y) const
+/* Recompute the bitboards, scaredness, and hash from scratch. This must
+ * be called whenever the pieces or the attacker are changed by anything
+ * but apply_move(). */
+void Board::pieces_changed()
 {
+    pieces_of[BLACK] = pieces_of[WHITE] = 0;
+    species[MOUSE] = species[LION] = species[ELEPHANT] = 0;
+    hash = (attacker == WHITE) ? zobrist().white_to_move : 0;
     for (int i=0; i < 6; ++i) {
-        if (black_pieces[i].x == x && black_pieces[i].y == y) return true;
-        if (white_pieces[i].x == x && white_pieces[i].y == y) return true;
+        const Bitboard w = square_bit(white_pieces[i].x, white_pieces[i].y);
+        const Bitboard b = square_bit(black_pieces[i].x, black_pieces[i].y);
+        pieces_of[WHITE] |= w;
+        pieces_of[BLACK] |= b;
+        species[white_pieces[i].type] |= w;
+        species[black_pieces[i].type] |= b;
+        hash ^= zobrist_key(WHITE, white_pieces[i]);
+        hash ^= zobrist_key(BLACK, black_pieces[i]);
     }
-    return false;
+    waterholes_held[WHITE] = popcount(pieces_of[WHITE] & WATERHOLES);
+    waterholes_held[BLACK] = popcount(pieces_of[BLACK] & WATERHOLES);
+    count_waterhole_threats(waterhole_threats);
+    this->update_scaredness();
+}
+
+/* Build a board from a picture in the same format as Board::str(),
+ * i.e., ten rows of ten characters each, top row first, with 'M','L','E'
+ * for White's pieces, 'm','l','e' for Black's, and '.' for empty squares.
+ * Whitespace between the characters is ignored. */
+Board::Board(const char *layout, Player attacker):
+    attacker(attacker), left(0), right(0), top(0), bottom(0)
+{
+    int white_found = 0;
+    int black_found = 0;
+    for (int y=0; y < 10; ++y) {
+        for (int x=0; x < 10; ++x) {
+            while (isspace(*layout)) ++layout;
+            assert(*layout != '\0');
+            switch (*layout++) {
+                case 'M': white_pieces[white_found++] = Piece(MOUSE, x,y); break;
+                case 'L': white_pieces[white_found++] = Piece(LION, x,y); break;
+                case 'E': white_pieces[white_found++] = Piece(ELEPHANT, x,y); break;
+                case 'm': black_pieces[black_found++] = Piece(MOUSE, x,y); break;
+                case 'l': black_pieces[black_found++] = Piece(LION, x,y); break;
+                case 'e': black_pieces[black_found++] = Piece(ELEPHANT, x,y); break;
+                case '.': break;
+                default: assert(false);
+            }
+            assert(white_found <= 6 && black_found <= 6);
+        }
+    }
+    assert(white_found == 6 && black_found == 6);
+    this->pieces_changed();
 }
 
 bool Piece::scares(const Piece &prey) const
@@ -73,129 +190,152 @@ bool Piece::is_adjacent(int ax, int ay) const
     return abs(x - ax) <= 1 && abs(y - ay) <= 1;
 }
 
-Move::Move(const Piece &p, int x, int y):
+Move::Move(const Piece &p, int x, int y, bool was_scared):
     from_x(p.x), from_y(p.y),
     to_x(x), to_y(y),
-    was_scared(p.is_scared),
+    was_scared(was_scared),
     score(0)
 { }
 
-void Board::maybe_append_move(std::vector<Move> &moves, const Piece &p, int x, int y) const
+/* Return the squares where a piece of species "prey" belonging to
+ * player "who" would be scared, i.e., the squares adjacent to one of
+ * the other player's pieces that scares "prey". */
+Bitboard Board::scare_zone(Player who, Species prey) const
 {
-    const Piece (&defenders_pieces)[6] = (attacker == WHITE) ? black_pieces : white_pieces;
+    /* Lions scare mice, elephants scare lions, and mice scare elephants. */
+    const Species predator = (Species)((prey + 1) % 3);
+    return adjacent_or_same(pieces_of[1-who] & species[predator]);
+}
 
-    /* Can't move to a place where you're scared,
-     * nor to an occupied space. */
-    for (int i=0; i < 6; ++i) {
-        if (white_pieces[i].at(x,y)) return;
-        if (black_pieces[i].at(x,y)) return;
-        if (defenders_pieces[i].scares(p) && defenders_pieces[i].is_adjacent(x,y))
-            return;
+/* Add the moves of "p" to any of the squares in "destinations" that it
+ * can reach, walking outward along its rays until something blocks it. */
+void Board::append_moves(MoveList &moves, const Piece &p, Bitboard destinations) const
+{
+    const int from = square_at(p.x, p.y);
+    const Bitboard occ = occupied();
+    switch (p.type) {
+        case MOUSE: destinations &= rook_moves(from, occ); break;
+        case LION: destinations &= bishop_moves(from, occ); break;
+        case ELEPHANT: destinations &= queen_moves(from, occ); break;
     }
-
-    if (clear_line_to(p, x,y)) {
-        moves.push_back(Move(p, x,y));
+    while (destinations != 0) {
+        moves.push_back(PackedMove(from, pop_lowest_square(destinations)));
     }
 }
 
-void Board::maybe_append_trapped_move(std::vector<Move> &moves, const Piece &p, int x, int y) const
+std::vector<Move> Board::find_all_moves() const
 {
-    assert(p.is_scared);
-
-    /* Can't move to an occupied space. */
-    for (int i=0; i < 6; ++i) {
-        if (white_pieces[i].at(x,y)) return;
-        if (black_pieces[i].at(x,y)) return;
-    }
-
-    if (clear_line_to(p, x,y)) {
-        moves.push_back(Move(p, x,y));
+    MoveList list;
+    this->find_all_moves(list);
+    std::vector<Move> moves;
+    for (int i=0; i < list.size; ++i) {
+        moves.push_back(this->unpack(list.moves[i]));
     }
+    return moves;
 }
 
-std::vector<Move> Board::find_all_moves() const
+void Board::find_all_moves(MoveList &moves) const
 {
     const Piece (&attackers_pieces)[6] = (attacker == WHITE) ? white_pieces : black_pieces;
 
-    std::vector<Move> moves;
-
-    if (this->score() == +9999) {
+    if (this->is_won()) {
         /* The current defender has just won the game. */
-        return moves;
+        return;
     }
 
-    for (int i=0; i < 6; ++i) {
-        for (int x=0; x < 10; ++x) {
-            for (int y=0; y < 10; ++y) {
-                maybe_append_move(moves, attackers_pieces[i], x, y);
-            }
-        }
-    }
+    /* Can't move to a place where you're scared,
+     * nor to an occupied space. */
+    const Bitboard empty = ALL_SQUARES & ~occupied();
 
     /* If any scared piece can move out of danger, then some scared piece
      * MUST move out of danger this turn. */
-    bool a_scared_piece_can_move = false;
-    for (int i=0; i < (int)moves.size(); ++i) {
-        if (moves[i].was_scared) {
-            a_scared_piece_can_move = true;
-        }
+    for (int i=0; i < 6; ++i) {
+        const Piece &p = attackers_pieces[i];
+        if (!is_scared(p)) continue;
+        append_moves(moves, p, empty & ~scare_zone(attacker, p.type));
+    }
+    if (moves.size != 0) {
+        return;
     }
 
-    if (a_scared_piece_can_move) {
-        int n = moves.size();
-        for (int i=0; i < n; ++i) {
-            while (i != n && !moves[i].was_scared) {
-                moves[i] = moves[--n];
-            }
-        }
-        moves.resize(n);
-    } else {
-        /* If all scared pieces are trapped, then it's okay to
-         * move a trapped piece from one dangerous spot to another;
-         * OR to move any non-trapped piece. */
-        for (int i=0; i < 6; ++i) {
-            if (!attackers_pieces[i].is_scared) continue;
-            for (int x=0; x < 10; ++x) {
-                for (int y=0; y < 10; ++y) {
-                    maybe_append_trapped_move(moves, attackers_pieces[i], x, y);
-                }
-            }
-        }
+    /* If all scared pieces are trapped, then it's okay to
+     * move a trapped piece from one dangerous spot to another;
+     * OR to move any non-trapped piece. */
+    for (int i=0; i < 6; ++i) {
+        const Piece &p = attackers_pieces[i];
+        if (is_scared(p)) continue;
+        append_moves(moves, p, empty & ~scare_zone(attacker, p.type));
+    }
+    for (int i=0; i < 6; ++i) {
+        if (!is_scared(attackers_pieces[i])) continue;
+        append_moves(moves, attackers_pieces[i], empty);
     }
 
-    assert(moves.size() >= 1);
-    return moves;
+    assert(moves.size >= 1);
+}
+
+/* Fill in the rest of a Move, for the benefit of the UI. */
+Move Board::unpack(const PackedMove &move) const
+{
+    const int from = move.from();
+    const Bitboard from_bit = square_bit(from);
+    Move result;
+    result.from_x = square_x(from);
+    result.from_y = square_y(from);
+    result.to_x = square_x(move.to());
+    result.to_y = square_y(move.to());
+    result.was_scared = ((scared & from_bit) != 0);
+    result.score = 0;
+    return result;
 }
 
 void Board::update_scaredness()
 {
-    for (int i=0; i < 6; ++i) {
-        white_pieces[i].is_scared = false;
-        black_pieces[i].is_scared = false;
-    }
-    for (int i=0; i < 6; ++i) {
-        Piece &yours = black_pieces[i];
-        for (int j=0; j < 6; ++j) {
-            Piece &mine = white_pieces[j];
-            if (!yours.is_adjacent(mine.x, mine.y)) continue;
-            if (yours.scares(mine)) {
-                mine.is_scared = true;
-            } else if (mine.scares(yours)) {
-                yours.is_scared = true;
-            }
+    scared = 0;
+    for (int who = BLACK; who <= WHITE; ++who) {
+        for (int s = MOUSE; s <= ELEPHANT; ++s) {
+            scared |= pieces_of[who] & species[s] & scare_zone((Player)who, (Species)s);
         }
     }
 }
 
 void Board::apply_move(const Move &move)
+{
+    Undo unused;
+    this->apply_move(PackedMove(square_at(move.from_x, move.from_y),
+                                square_at(move.to_x, move.to_y)), unused);
+}
+
+void Board::apply_move(const PackedMove &move, Undo &undo)
 {
     Piece (&attackers_pieces)[6] = (attacker == WHITE) ? white_pieces : black_pieces;
+    const int from = move.from();
+    const int to = move.to();
+
+    undo.scared = scared;
+    undo.hash = hash;
+    undo.waterhole_threats[BLACK] = waterhole_threats[BLACK];
+    undo.waterhole_threats[WHITE] = waterhole_threats[WHITE];
 
     /* Which piece is the one that's moving? */
     for (int i=0; i < 6; ++i) {
-        if (attackers_pieces[i].x == move.from_x && attackers_pieces[i].y == move.from_y) {
-            attackers_pieces[i].x = move.to_x;
-            attackers_pieces[i].y = move.to_y;
+        if (attackers_pieces[i].at(square_x(from), square_y(from))) {
+            assert(clear_line_to(attackers_pieces[i], square_x(to), square_y(to)));
+            const Bitboard from_to = square_bit(from) | square_bit(to);
+            /* Only the waterhole rays through the two squares can change. */
+            const uint32_t rays = waterhole_rays().through[from] | waterhole_rays().through[to];
+            adjust_waterhole_threats(rays, -1);
+            pieces_of[attacker] ^= from_to;
+            species[attackers_pieces[i].type] ^= from_to;
+            adjust_waterhole_threats(rays, +1);
+            waterholes_held[attacker] += ((WATERHOLES & square_bit(to)) != 0) -
+                                         ((WATERHOLES & square_bit(from)) != 0);
+            hash ^= zobrist_key(attacker, attackers_pieces[i]);
+            attackers_pieces[i].x = square_x(to);
+            attackers_pieces[i].y = square_y(to);
+            hash ^= zobrist_key(attacker, attackers_pieces[i]);
+            hash ^= zobrist().white_to_move;
+            undo.piece = i;
             this->attacker = ((attacker == WHITE) ? BLACK : WHITE);
             this->update_scaredness();
             return;
@@ -205,6 +345,48 @@ void Board::apply_move(const Move &move)
     assert(false);
 }
 
+/* Take back "move", which must have been the last move applied. */
+void Board::unapply_move(const PackedMove &move, const Undo &undo)
+{
+    const int from = move.from();
+    const int to = move.to();
+    this->attacker = ((attacker == WHITE) ? BLACK : WHITE);
+    Piece &p = ((attacker == WHITE) ? white_pieces : black_pieces)[undo.piece];
+    assert(p.at(square_x(to), square_y(to)));
+    const Bitboard from_to = square_bit(from) | square_bit(to);
+    pieces_of[attacker] ^= from_to;
+    species[p.type] ^= from_to;
+    waterholes_held[attacker] -= ((WATERHOLES & square_bit(to)) != 0) -
+                                 ((WATERHOLES & square_bit(from)) != 0);
+    p.x = square_x(from);
+    p.y = square_y(from);
+    scared = undo.scared;
+    hash = undo.hash;
+    waterhole_threats[BLACK] = undo.waterhole_threats[BLACK];
+    waterhole_threats[WHITE] = undo.waterhole_threats[WHITE];
+}
+
+/* Pass the turn to the defender, for the search's null-move pruning;
+ * Barca itself has no such move. A player with a scared piece is
+ * usually forced to move it, so passing would tell us nothing about
+ * the position, and in that case we refuse and return false. */
+bool Board::apply_null_move(Undo &undo)
+{
+    if (pieces_of[attacker] & scared)
+      return false;
+    /* Nothing moves, so only the hash and the attacker change. */
+    undo.hash = hash;
+    hash ^= zobrist().white_to_move;
+    this->attacker = ((attacker == WHITE) ? BLACK : WHITE);
+    return true;
+}
+
+void Board::unapply_null_move(const Undo &undo)
+{
+    this->attacker = ((attacker == WHITE) ? BLACK : WHITE);
+    hash = undo.hash;
+}
+
 bool Board::clear_line_to(const Piece &p, int to_x, int to_y) const
 {
     if (p.at(to_x, to_y)) return false;
@@ -220,40 +402,84 @@ bool Board::clear_line_to(const Piece &p, int to_x, int to_y) const
     }
 
     /* Can't move through an occupied space. */
-    int ox = p.x;
-    int oy = p.y;
-    while (true) {
-        ox += (dx > 0) - (dx < 0);
-        oy += (dy > 0) - (dy < 0);
-        if (ox == to_x && oy == to_y) break;
-        if (is_occupied(ox, oy)) return false;
-    }
-    return true;
+    return (between(square_at(p.x, p.y), square_at(to_x, to_y)) & occupied()) == 0;
 }
 
-int Board::waterholes_threatened_by(const Piece &p) const
+/* Add "sign" times the threats along each of the given waterhole rays
+ * to waterhole_threats. See count_waterhole_threats(). */
+void Board::adjust_waterhole_threats(uint32_t rays, int sign)
 {
-    return clear_line_to(p, 3,3) + clear_line_to(p, 3,6) +
-           clear_line_to(p, 6,3) + clear_line_to(p, 6,6);
+    const Bitboard occ = occupied();
+    const Bitboard rook_movers = species[MOUSE] | species[ELEPHANT];
+    const Bitboard bishop_movers = species[LION] | species[ELEPHANT];
+    while (rays != 0) {
+        const int r = __builtin_ctz(rays);
+        rays &= rays - 1;
+        const int w = waterhole_squares[r / 8];
+        const int d = r % 8;
+        const Bitboard blockers = ray(d, w) & occ;
+        if (blockers == 0) continue;
+        const int first = direction_increases(d) ? lowest_square(blockers) : highest_square(blockers);
+        const Bitboard blocker = square_bit(first) & ((d <= NORTH) ? rook_movers : bishop_movers);
+        waterhole_threats[WHITE] += sign * ((blocker & pieces_of[WHITE]) != 0);
+        waterhole_threats[BLACK] += sign * ((blocker & pieces_of[BLACK]) != 0);
+    }
 }
 
-/* Return the board's value to the defender.
- * Higher is better for the defender. */
-int Board::score() const
+/* For each player, count the pieces with a clear line to each waterhole,
+ * i.e., the pieces that could move onto the waterhole if it were empty
+ * and they weren't scared. Walking outward from each waterhole, the first
+ * piece we meet in each direction is the only one with a clear line;
+ * it counts if it moves that way (mice and elephants move like rooks,
+ * lions and elephants like bishops). */
+void Board::count_waterhole_threats(int threats[2]) const
 {
-    int my_score = 0, your_score = 0;
-    int my_scared = 0, your_scared = 0;
-    int my_threats = 0, your_threats = 0;
-    for (int i=0; i < 6; ++i) {
-        my_score += white_pieces[i].at(3,3); your_score += black_pieces[i].at(3,3);
-        my_score += white_pieces[i].at(3,6); your_score += black_pieces[i].at(3,6);
-        my_score += white_pieces[i].at(6,3); your_score += black_pieces[i].at(6,3);
-        my_score += white_pieces[i].at(6,6); your_score += black_pieces[i].at(6,6);
-        my_scared += white_pieces[i].is_scared;
-        your_scared += black_pieces[i].is_scared;
-        my_threats += waterholes_threatened_by(white_pieces[i]);
-        your_threats += waterholes_threatened_by(black_pieces[i]);
+    const Bitboard occ = occupied();
+    const Bitboard rook_movers = species[MOUSE] | species[ELEPHANT];
+    const Bitboard bishop_movers = species[LION] | species[ELEPHANT];
+    threats[BLACK] = threats[WHITE] = 0;
+    Bitboard holes = WATERHOLES;
+    while (holes != 0) {
+        const int w = pop_lowest_square(holes);
+        for (int d=0; d < 8; ++d) {
+            const Bitboard blockers = ray(d, w) & occ;
+            if (blockers == 0) continue;
+            const int first = direction_increases(d) ? lowest_square(blockers) : highest_square(blockers);
+            const Bitboard blocker = square_bit(first) & ((d <= NORTH) ? rook_movers : bishop_movers);
+            threats[WHITE] += ((blocker & pieces_of[WHITE]) != 0);
+            threats[BLACK] += ((blocker & pieces_of[BLACK]) != 0);
+        }
     }
+}
+
+/* Return zero if the given move is "quiet", or a positive number if it
+ * forces the issue: 2 for moving onto a waterhole, plus 1 for scaring
+ * one of the defender's pieces that wasn't already scared, plus 1 for
+ * taking a scared piece out of danger. */
+int Board::tactical_value(const PackedMove &move) const
+{
+    const int to = move.to();
+    const Species mover = species_at(move.from());
+    /* Lions scare mice, elephants scare lions, and mice scare elephants. */
+    const Species prey = (Species)((mover + 2) % 3);
+    int value = 0;
+    if (WATERHOLES & square_bit(to)) value += 2;
+    if (adjacent_or_same(square_bit(to)) & pieces_of[1-attacker] & species[prey] & ~scared) value += 1;
+    if ((scared & square_bit(move.from())) && !(scare_zone(attacker, mover) & square_bit(to))) value += 1;
+    return value;
+}
+
+/* The same as score(), but computed directly from the pieces. */
+int Board::score_from_scratch() const
+{
+    int my_score = popcount(pieces_of[WHITE] & WATERHOLES);
+    int your_score = popcount(pieces_of[BLACK] & WATERHOLES);
+    const int my_scared = popcount(pieces_of[WHITE] & scared);
+    const int your_scared = popcount(pieces_of[BLACK] & scared);
+    int threats[2];
+    count_waterhole_threats(threats);
+    const int my_threats = threats[WHITE];
+    const int your_threats = threats[BLACK];
     assert(my_score + your_score <= 4);
     assert(my_score <= 3);
     assert(your_score <= 3);
@@ -269,43 +495,463 @@ int Board::score() const
     return (attacker == WHITE) ? -my_advantage : +my_advantage;
 }
 
-static int usec_difference(struct timeval a, struct timeval b)
+/* score_moves() works on the boards after each move all at once, with
+ * each bitboard held as two 64-bit halves in an array of its own, one
+ * entry per board ("structure of arrays"): that way each step is a loop
+ * doing the same few integer operations to every board, which the
+ * compiler can turn into vector instructions. The helpers below are the
+ * Bitboard operations it needs, done on the halves.
+ *   GCC vectorizes loops like these only at -O3, which is why the
+ * Makefile builds this file with it; and x86-64 promises only SSE2, which
+ * gains little, so where we can (GCC on x86-64 Linux), they're built for
+ * both AVX2 and plain x86-64, and the loader picks whichever the machine
+ * can run. */
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && defined(__linux__)
+ #define VECTORIZED __attribute__((target_clones("avx2", "default")))
+ #define VECTORIZED_INLINE __attribute__((always_inline)) inline
+#else
+ #define VECTORIZED
+ #define VECTORIZED_INLINE inline
+#endif
+
+static VECTORIZED_INLINE void shift_up(uint64_t &lo, uint64_t &hi, int k)
+{
+    hi = (hi << k) | (lo >> (64 - k));
+    lo <<= k;
+}
+static VECTORIZED_INLINE void shift_down(uint64_t &lo, uint64_t &hi, int k)
+{
+    lo = (lo >> k) | (hi << (64 - k));
+    hi >>= k;
+}
+/* adjacent_or_same(), on halves. */
+static VECTORIZED_INLINE void adjacent_halves(uint64_t lo, uint64_t hi, uint64_t &out_lo, uint64_t &out_hi)
+{
+    const uint64_t not_east_lo = (uint64_t)~EAST_EDGE, not_east_hi = (uint64_t)(~EAST_EDGE >> 64);
+    const uint64_t not_west_lo = (uint64_t)~WEST_EDGE, not_west_hi = (uint64_t)(~WEST_EDGE >> 64);
+    uint64_t elo = lo & not_east_lo, ehi = hi & not_east_hi;
+    uint64_t wlo = lo & not_west_lo, whi = hi & not_west_hi;
+    shift_up(elo, ehi, 1);
+    shift_down(wlo, whi, 1);
+    const uint64_t rlo = lo | elo | wlo, rhi = hi | ehi | whi;
+    uint64_t slo = rlo, shi = rhi, nlo = rlo, nhi = rhi;
+    shift_up(slo, shi, 10);
+    shift_down(nlo, nhi, 10);
+    out_lo = rlo | slo | nlo;
+    out_hi = (rhi | shi | nhi) & (uint64_t)(ALL_SQUARES >> 64);
+}
+/* popcount(), without the popcount instruction, which has no vector form. */
+static VECTORIZED_INLINE int count_bits(uint64_t x)
+{
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    x += x >> 8;
+    x += x >> 16;
+    x += x >> 32;
+    return (int)(x & 0x7f);
+}
+
+/* For each of "n" boards, add 1 to threats[i] if the first piece along
+ * the ray "ray" (which walks toward higher-numbered squares) is one of
+ * "movers". This is a separate function so that the compiler can see
+ * that the arrays don't overlap. */
+static VECTORIZED void count_ray_threats(int n, uint64_t ray_lo, uint64_t ray_hi,
+                              const uint64_t *__restrict occ_lo, const uint64_t *__restrict occ_hi,
+                              const uint64_t *__restrict movers_lo, const uint64_t *__restrict movers_hi,
+                              uint64_t *__restrict threats)
+{
+    for (int i=0; i < n; ++i) {
+        const uint64_t blockers_lo = ray_lo & occ_lo[i];
+        const uint64_t blockers_hi = ray_hi & occ_hi[i];
+        const uint64_t first_lo = blockers_lo & (0 - blockers_lo);
+        const uint64_t first_hi = blockers_hi & (0 - blockers_hi) & (0 - (uint64_t)(blockers_lo == 0));
+        threats[i] += ((first_lo & movers_lo[i]) | (first_hi & movers_hi[i])) != 0;
+    }
+}
+
+/* "b" turned half way round, so that square sq becomes square 99-sq. A
+ * ray that walks toward lower-numbered squares becomes one that walks
+ * toward higher-numbered squares, whose first blocker is just the lowest
+ * set bit. */
+static Bitboard turned_round(Bitboard b)
+{
+    Bitboard t = 0;
+    while (b != 0) {
+        t |= square_bit(99 - pop_lowest_square(b));
+    }
+    return t;
+}
+
+/* The 32 rays out from the waterholes, for score_moves(): each one as a
+ * pair of halves, walking toward higher-numbered squares on either the
+ * board or the board turned round. */
+struct BatchRays {
+    uint64_t lo[32], hi[32];
+    bool turned[32];
+    bool rook[32];  /* does it run along a rank or file? */
+
+    BatchRays() {
+        for (int h=0; h < 4; ++h) {
+            for (int d=0; d < 8; ++d) {
+                const int r = 8*h + d;
+                turned[r] = !direction_increases(d);
+                rook[r] = (d <= NORTH);
+                const Bitboard b = turned[r] ? turned_round(ray(d, waterhole_squares[h]))
+                                             : ray(d, waterhole_squares[h]);
+                lo[r] = (uint64_t)b;
+                hi[r] = (uint64_t)(b >> 64);
+            }
+        }
+    }
+};
+
+static const BatchRays &batch_rays()
 {
-    return (b.tv_sec - a.tv_sec) * 1000 * 1000 + ((int)b.tv_usec - (int)a.tv_usec);
+    static const BatchRays rays;
+    return rays;
+}
+
+/* Set values[i] to the score() of the board after moves[i], i.e., the
+ * value of moves[i] to the attacker; the same as applying each move,
+ * calling score() and taking it back again, but with the boards done
+ * side by side (see above) instead of one after another. */
+VECTORIZED void Board::score_moves(const PackedMove *moves, int n, int *values) const
+{
+    enum { N = MoveList::CAPACITY };
+    assert(0 <= n && n <= N);
+    /* The pieces of each player and species, on the board and turned round. */
+    uint64_t lo[2][2][3][N], hi[2][2][3][N];
+    Bitboard parent[2][2][3];
+    for (int who = BLACK; who <= WHITE; ++who) {
+        for (int s = MOUSE; s <= ELEPHANT; ++s) {
+            parent[0][who][s] = pieces_of[who] & species[s];
+            parent[1][who][s] = turned_round(parent[0][who][s]);
+        }
+    }
+    for (int t=0; t < 2; ++t) {
+        for (int who = BLACK; who <= WHITE; ++who) {
+            for (int s = MOUSE; s <= ELEPHANT; ++s) {
+                const uint64_t plo = (uint64_t)parent[t][who][s];
+                const uint64_t phi = (uint64_t)(parent[t][who][s] >> 64);
+                for (int i=0; i < n; ++i) {
+                    lo[t][who][s][i] = plo;
+                    hi[t][who][s][i] = phi;
+                }
+            }
+        }
+    }
+    for (int i=0; i < n; ++i) {
+        const int from = moves[i].from(), to = moves[i].to();
+        const Species s = species_at(from);
+        const Bitboard from_to = square_bit(from) | square_bit(to);
+        const Bitboard turned_from_to = square_bit(99 - from) | square_bit(99 - to);
+        lo[0][attacker][s][i] ^= (uint64_t)from_to;
+        hi[0][attacker][s][i] ^= (uint64_t)(from_to >> 64);
+        lo[1][attacker][s][i] ^= (uint64_t)turned_from_to;
+        hi[1][attacker][s][i] ^= (uint64_t)(turned_from_to >> 64);
+    }
+
+    /* The waterholes held, and the scared pieces. Lions scare mice,
+     * elephants scare lions, and mice scare elephants. */
+    int held[2][N], scared_count[2][N];
+    const uint64_t holes_lo = (uint64_t)WATERHOLES, holes_hi = (uint64_t)(WATERHOLES >> 64);
+    for (int who = BLACK; who <= WHITE; ++who) {
+        const int other = 1 - who;
+        for (int i=0; i < n; ++i) {
+            const uint64_t mlo = lo[0][who][MOUSE][i], mhi = hi[0][who][MOUSE][i];
+            const uint64_t llo = lo[0][who][LION][i], lhi = hi[0][who][LION][i];
+            const uint64_t elo = lo[0][who][ELEPHANT][i], ehi = hi[0][who][ELEPHANT][i];
+            held[who][i] = count_bits(((mlo | llo | elo) & holes_lo)) +
+                           count_bits(((mhi | lhi | ehi) & holes_hi));
+            uint64_t zlo, zhi, slo = 0, shi = 0;
+            adjacent_halves(lo[0][other][LION][i], hi[0][other][LION][i], zlo, zhi);
+            slo |= mlo & zlo;
+            shi |= mhi & zhi;
+            adjacent_halves(lo[0][other][ELEPHANT][i], hi[0][other][ELEPHANT][i], zlo, zhi);
+            slo |= llo & zlo;
+            shi |= lhi & zhi;
+            adjacent_halves(lo[0][other][MOUSE][i], hi[0][other][MOUSE][i], zlo, zhi);
+            slo |= elo & zlo;
+            shi |= ehi & zhi;
+            scared_count[who][i] = count_bits(slo) + count_bits(shi);
+        }
+    }
+
+    /* The pieces with a clear line to each waterhole, as in
+     * count_waterhole_threats(). */
+    uint64_t occ_lo[2][N], occ_hi[2][N];
+    uint64_t movers_lo[2][2][2][N], movers_hi[2][2][2][N];  /* [turned][who][rook] */
+    for (int t=0; t < 2; ++t) {
+        for (int i=0; i < n; ++i) {
+            occ_lo[t][i] = occ_hi[t][i] = 0;
+        }
+        for (int who = BLACK; who <= WHITE; ++who) {
+            for (int i=0; i < n; ++i) {
+                const uint64_t mlo = lo[t][who][MOUSE][i], mhi = hi[t][who][MOUSE][i];
+                const uint64_t llo = lo[t][who][LION][i], lhi = hi[t][who][LION][i];
+                const uint64_t elo = lo[t][who][ELEPHANT][i], ehi = hi[t][who][ELEPHANT][i];
+                occ_lo[t][i] |= mlo | llo | elo;
+                occ_hi[t][i] |= mhi | lhi | ehi;
+                movers_lo[t][who][1][i] = mlo | elo;
+                movers_hi[t][who][1][i] = mhi | ehi;
+                movers_lo[t][who][0][i] = llo | elo;
+                movers_hi[t][who][0][i] = lhi | ehi;
+            }
+        }
+    }
+    /* The counts are 64 bits wide, like everything else in the loop, so
+     * that it vectorizes. */
+    uint64_t threats[2][N];
+    for (int i=0; i < n; ++i) {
+        threats[BLACK][i] = threats[WHITE][i] = 0;
+    }
+    const BatchRays &rays = batch_rays();
+    for (int r=0; r < 32; ++r) {
+        const int t = rays.turned[r];
+        const int k = rays.rook[r];
+        count_ray_threats(n, rays.lo[r], rays.hi[r], occ_lo[t], occ_hi[t],
+                          movers_lo[t][WHITE][k], movers_hi[t][WHITE][k], threats[WHITE]);
+        count_ray_threats(n, rays.lo[r], rays.hi[r], occ_lo[t], occ_hi[t],
+                          movers_lo[t][BLACK][k], movers_hi[t][BLACK][k], threats[BLACK]);
+    }
+
+    /* Now put it together as score() does, for the mover's opponent,
+     * who is the attacker on every one of these boards. */
+    const int sign = (attacker == WHITE) ? +1 : -1;
+    for (int i=0; i < n; ++i) {
+        const int white_advantage =
+            (10*held[WHITE][i] + (int)threats[WHITE][i] + scared_count[BLACK][i]) -
+            (10*held[BLACK][i] + (int)threats[BLACK][i] + scared_count[WHITE][i]);
+        values[i] = (held[WHITE][i] == 3 || held[BLACK][i] == 3) ? 9999 : sign * white_advantage;
+    }
+}
+
+/* Print what the search that just finished did. */
+static void report_search(int completed)
+{
+    for (int i=0; i < (int)ab.iterations.size(); ++i) {
+        const BarcaSearch::Iteration &it = ab.iterations[i];
+        printf("ply=%d value=%d nodes=%lu time=%.3fs%s\n", it.ply, it.value, it.nodes,
+               it.usec / 1e6, it.researches ? " (re-searched)" : "");
+    }
+    printf("Breaking off search after ply=%d%s.\n", completed,
+           ab.ran_out_of_time() ? " (ran out of time during the next ply)" : "");
+    if (search_options.threads > 1) {
+        printf("Searched %lu nodes in total with %d threads.\n", ab.nodes, search_options.threads);
+    }
+
+    printf("Nodes at each ply:");
+    for (int h=0; h < (int)ab.stats.nodes_at_height.size(); ++h) {
+        printf(" %lu", ab.stats.nodes_at_height[h]);
+    }
+    printf("\nFirst move cut off %lu of %lu times (%.1f%%)\n",
+           ab.stats.first_move_cutoffs, ab.stats.cutoffs,
+           ab.stats.cutoffs ? 100.0 * ab.stats.first_move_cutoffs / ab.stats.cutoffs : 0.0);
+    if (search_options.selective) {
+        printf("Null moves cut off %lu times; reduced %lu late moves, re-searched %lu\n",
+               ab.stats.null_move_cutoffs, ab.stats.reductions, ab.stats.researches);
+    }
+}
+
+/* Try to prove a forced win with "solver". It looks much deeper along
+ * forcing lines than the main search can, for a small fraction of the
+ * time. If it succeeds, set "move" and return true. Otherwise, return
+ * how long it took in "spent", for the main search to deduct. */
+static bool find_forced_win(const Board &board, PackedMove &move, long &spent)
+{
+    const long start = now_usec();
+    solver.nodes = 0;
+    const bool won = (solver.prove(board, BARCA_PROOF_NODES, move) == BarcaProofSearch::PROVEN);
+    spent = now_usec() - start;
+    if (won) {
+        printf("Found a forced win in %lu nodes (%.3fs).\n", solver.nodes, spent / 1e6);
+        /* There's nothing to ponder. */
+        last_search_depth = 0;
+    }
+    return won;
+}
+
+/* Print what "mcts" did in the "playouts" playouts it made over the
+ * last "usec" microseconds. */
+static void report_mcts(unsigned long playouts, long usec)
+{
+    printf("Made %lu playouts in %.3fs (%.0f per second) with %d threads; %lu nodes in the tree.\n",
+           playouts, usec / 1e6, playouts / (usec / 1e6), search_options.threads,
+           mcts.stats.tree_nodes);
+    printf("The best move was tried %lu times, and scored %.1f%%.\n",
+           mcts.stats.best_visits, 100.0 * mcts.stats.best_score);
 }
 
 Move Board::find_best_move() const
 {
-    Move bestmove;
+    PackedMove bestmove;
     int bestvalue;
-    std::vector<Move> all_moves = this->find_all_moves();
-    printf("Found %d moves\n", (int)all_moves.size());
-
-    /* Spend up to 2 seconds searching. */
-    struct timeval start;
-    gettimeofday(&start, NULL);
-    struct timeval last_iter = start;
-
-    for (int ply = 1; ply <= 7; ++ply) {
-        if (ply == 2) continue;
-
-        /* Expect the search at level N to take 30 times as long
-         * as the search took at level N-1. */
-        struct timeval current;
-        gettimeofday(&current, NULL);
-        int estimated_completion =
-            usec_difference(start, current) +
-            30*usec_difference(last_iter, current);
-        if (estimated_completion > 2*1000*1000) {
-            printf("Breaking off search after ply=%d.\n", ply);
-            break;
+    long spent;
+    MoveList all_moves;
+    this->find_all_moves(all_moves);
+    printf("Found %d moves\n", all_moves.size);
+    if (find_forced_win(*this, bestmove, spent))
+      return this->unpack(bestmove);
+    if (search_options.mcts) {
+        const long usec = std::max(search_options.usec - spent, 1L);
+        mcts.search(*this, search_options.threads, usec, bestmove);
+        report_mcts(mcts.stats.playouts, usec);
+        return this->unpack(bestmove);
+    }
+
+    /* What we learned on our previous move is still useful,
+     * but shouldn't crowd out the results of this search. */
+    ab.new_search();
+    ab.set_selectivity(search_options.selective, search_options.selective);
+    ab.set_quiescence(BARCA_QUIESCENCE_PLIES);
+    ab.reset_stats();
+    ab.nodes = 0;
+
+    /* Spend up to our time budget searching, going as deep as we can. */
+    const int completed = ab.parallel_iterative_deepening(*this, search_options.threads,
+                              MAX_PLY, std::max(search_options.usec - spent, 1L), bestmove, bestvalue,
+                              /*alpha=*/-9999, /*beta=*/+9999, ASPIRATION_WINDOW);
+    last_search_depth = completed;
+    report_search(completed);
+    return this->unpack(bestmove);
+}
+
+/* The same, but think for SLICE_USEC at a time, and call
+ * "between_slices" in between. If it returns false, because this
+ * position is no longer of interest, give up and return false. The
+ * time it takes counts against our budget too, as it's on our clock. */
+bool Board::find_best_move(Move &move, bool (*between_slices)(const Board &)) const
+{
+    PackedMove bestmove;
+    int bestvalue;
+    int completed = 0;
+    long spent;
+    MoveList all_moves;
+    this->find_all_moves(all_moves);
+    printf("Found %d moves\n", all_moves.size);
+    if (find_forced_win(*this, bestmove, spent)) {
+        move = this->unpack(bestmove);
+        return true;
+    }
+    if (search_options.mcts) {
+        /* The tree is kept from one call to the next, so searching a
+         * slice at a time loses nothing. */
+        const long start = now_usec();
+        const long budget = std::max(search_options.usec - spent, 1L);
+        unsigned long playouts = 0;
+        while (true) {
+            const long left = budget - (now_usec() - start);
+            mcts.search(*this, search_options.threads, std::max(std::min(SLICE_USEC, left), 1L),
+                        bestmove);
+            playouts += mcts.stats.playouts;
+            if (now_usec() - start >= budget)
+              break;
+            if (!between_slices(*this))
+              return false;
         }
+        report_mcts(playouts, now_usec() - start);
+        move = this->unpack(bestmove);
+        return true;
+    }
 
-        ab.depth_first_alpha_beta(*this, ply, bestmove, bestvalue,
-                                  /*alpha=*/-9999, /*beta=*/+9999);
-        if (bestvalue == +9999) break;
+    ab.new_search();
+    ab.set_selectivity(search_options.selective, search_options.selective);
+    ab.set_quiescence(BARCA_QUIESCENCE_PLIES);
+    ab.reset_stats();
+    ab.nodes = 0;
+
+    {
+        CancellationToken token;
+        BarcaAnytimeSearch search(ab, *this, search_options.threads, MAX_PLY,
+                                  /*alpha=*/-9999, /*beta=*/+9999, ASPIRATION_WINDOW, token);
+        const long start = now_usec();
+        const long budget = search_options.usec - spent;
+        while (true) {
+            const long left = budget - (now_usec() - start);
+            if (left <= 0 || !search.step(std::min(SLICE_USEC, left)))
+              break;
+            if (now_usec() - start >= budget)
+              break;
+            if (!between_slices(*this))
+              return false;
+        }
+        /* However little time the solver left us, finish one iteration. */
+        while (!search.best_so_far(bestmove, bestvalue, completed) && search.step(SLICE_USEC))
+          continue;
+        /* Destroying the search stops it. */
+    }
+    last_search_depth = completed;
+    report_search(completed);
+    move = this->unpack(bestmove);
+    return true;
+}
+
+void Ponderer::start(const Board &board)
+{
+    this->stop();
+    /* Monte Carlo tree search keeps its tree between moves instead. */
+    if (search_options.mcts)
+      return;
+    root = board;
+    completed = 0;
+    pv.clear();
+    stop_flag = false;
+    running = true;
+    ab.new_search();
+    ab.set_selectivity(search_options.selective, search_options.selective);
+    ab.set_quiescence(BARCA_QUIESCENCE_PLIES);
+    ab.set_stop_flag(&stop_flag);
+    thread = std::thread([this]() {
+        PackedMove move;
+        int value;
+        completed = ab.parallel_iterative_deepening(root, search_options.threads, MAX_PLY, 0,
+                                                    move, value, /*alpha=*/-9999, /*beta=*/+9999,
+                                                    ASPIRATION_WINDOW);
+        pv = ab.principal_variation();
+    });
+}
+
+void Ponderer::stop()
+{
+    if (!running) return;
+    stop_flag = true;
+    thread.join();
+    ab.set_stop_flag(NULL);
+    running = false;
+    if (completed > 0 && !pv.empty()) {
+        const Move expected = root.unpack(pv[0]);
+        printf("Pondered to ply=%d, expecting (%d,%d) to (%d,%d).\n", completed,
+               expected.from_x, expected.from_y, expected.to_x, expected.to_y);
+    }
+}
+
+bool Ponderer::is_pondering(const Board &board) const
+{
+    return running && root.hash == board.hash && root.str() == board.str();
+}
+
+bool Ponderer::predicted_reply(const Board &board, Move &reply) const
+{
+    assert(!running);
+    if (last_search_depth == 0 || completed-1 < last_search_depth || pv.size() < 2) {
+        return false;
+    }
+    Board expected = root;
+    Board::Undo unused;
+    expected.apply_move(pv[0], unused);
+    if (expected.hash != board.hash || expected.str() != board.str()) {
+        return false;
     }
-    return bestmove;
+    MoveList moves;
+    board.find_all_moves(moves);
+    for (int i=0; i < moves.size; ++i) {
+        if (moves.moves[i] == pv[1]) {
+            reply = board.unpack(pv[1]);
+            return true;
+        }
+    }
+    return false;
 }
 
 Move Board::find_random_move() const
@@ -314,9 +960,9 @@ Move Board::find_random_move() const
     return all_moves[rand() % all_moves.size()];
 }
 
-static char piece2char(Player who, const Piece &p)
+static char piece2char(Player who, const Piece &p, bool is_scared)
 {
-    if (p.is_scared) return '!';
+    if (is_scared) return '!';
     switch (p.type)
     {
         case MOUSE: return (who == WHITE ? 'M' : 'm');
@@ -331,8 +977,8 @@ std::string Board::str() const
     char board[10][10];
     memset(board, '.', sizeof board);
     for (int i=0; i < 6; ++i) {
-        board[white_pieces[i].x][white_pieces[i].y] = piece2char(WHITE, white_pieces[i]);
-        board[black_pieces[i].x][black_pieces[i].y] = piece2char(BLACK, black_pieces[i]);
+        board[white_pieces[i].x][white_pieces[i].y] = piece2char(WHITE, white_pieces[i], is_scared(white_pieces[i]));
+        board[black_pieces[i].x][black_pieces[i].y] = piece2char(BLACK, black_pieces[i], is_scared(black_pieces[i]));
     }
 
     std::string result;
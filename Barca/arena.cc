@@ -0,0 +1,508 @@
+#include <assert.h>
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Board.h"
+#include "Search.h"
+
+/* barca_arena plays one engine against another, many games at a time,
+ * entirely offline: no screenshots, no clicks, just Boards. Each game
+ * starts from an opening, and each opening is played twice, with each
+ * engine taking each side once. */
+
+static const char start_layout[] =
+    "....EE...."
+    "...LMML..."
+    ".........."
+    ".........."
+    ".........."
+    ".........."
+    ".........."
+    ".........."
+    "...lmml..."
+    "....ee....";
+
+struct Opening {
+    std::string layout;
+    Player attacker;
+};
+
+/* The engines we know how to play, and what each one does differently
+ * from find_best_move(). */
+enum EngineKind { DEFAULT, FULL_WIDTH, NO_QUIESCENCE, NO_SOLVER, MCTS, RANDOM };
+static const struct {
+    const char *name;
+    EngineKind kind;
+} engine_kinds[] = {
+    { "default", DEFAULT },
+    { "full-width", FULL_WIDTH },
+    { "no-quiescence", NO_QUIESCENCE },
+    { "no-solver", NO_SOLVER },
+    { "mcts", MCTS },
+    { "random", RANDOM },
+};
+static const int num_engine_kinds = sizeof engine_kinds / sizeof engine_kinds[0];
+
+struct EngineSpec {
+    std::string name;  /* as given on the command line, e.g. "mcts:500" */
+    EngineKind kind;
+    long usec;         /* per move */
+};
+
+/* One side of a game. Each Engine has its own tables, so that games on
+ * different threads share nothing. It thinks the way find_best_move()
+ * does: the solver first, then the main search in whatever time is left;
+ * but on one thread, since the arena's parallelism is across games. */
+class Engine {
+  public:
+    Engine(const EngineSpec &spec, uint64_t seed):
+        nodes(0), usec(0), depth(0), searches(0),
+        spec(spec), tt(18), ab(&tt, BARCA_HISTORY_SIZE),
+        solver(18, 9999), mcts(9999, BARCA_PLAYOUT_PLIES), rng(seed | 1)
+    {
+        const bool selective = (spec.kind != FULL_WIDTH);
+        ab.set_selectivity(selective, selective);
+        ab.set_quiescence((spec.kind != NO_QUIESCENCE) ? BARCA_QUIESCENCE_PLIES : 0);
+    }
+
+    void new_game() {
+        ab.forget();
+        solver.clear();
+        mcts.clear();
+    }
+
+    PackedMove choose(const Board &board);
+
+    /* The main search's nodes (playouts, for MCTS) and the time spent
+     * choosing moves, over all games; and the total depth of the
+     * alpha-beta searches, and how many there were. */
+    unsigned long nodes;
+    long usec;
+    long depth;
+    long searches;
+
+  private:
+    EngineSpec spec;
+    TranspositionTable<PackedMove, int> tt;
+    BarcaSearch ab;
+    BarcaProofSearch solver;
+    BarcaMonteCarlo mcts;
+    uint64_t rng;
+};
+
+static uint64_t random_number(uint64_t &rng)
+{
+    /* xorshift64* */
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return rng * 2685821657736338717ULL;
+}
+
+PackedMove Engine::choose(const Board &board)
+{
+    const long start = now_usec();
+    PackedMove move;
+    if (spec.kind == RANDOM) {
+        MoveList moves;
+        board.find_all_moves(moves);
+        move = moves.moves[random_number(rng) % moves.size];
+        usec += now_usec() - start;
+        return move;
+    }
+    /* find_best_move() gives the solver a fixed number of nodes, which
+     * is a small part of play_barca's default two seconds, but could be
+     * all of a short move here; so give it the same part of our time. */
+    const unsigned long proof_nodes = std::max(BARCA_PROOF_NODES * spec.usec / (2*1000*1000), 1000UL);
+    if (spec.kind != NO_SOLVER &&
+        solver.prove(board, proof_nodes, move) == BarcaProofSearch::PROVEN) {
+        usec += now_usec() - start;
+        return move;
+    }
+    const long left = std::max(spec.usec - (now_usec() - start), 1L);
+    if (spec.kind == MCTS) {
+        mcts.search(board, 1, left, move);
+        nodes += mcts.stats.playouts;
+    } else {
+        int value;
+        ab.new_search();
+        ab.nodes = 0;
+        depth += ab.iterative_deepening(board, 64, left, move, value,
+                                        /*alpha=*/-9999, /*beta=*/+9999, /*aspiration=*/5);
+        searches += 1;
+        nodes += ab.nodes;
+    }
+    usec += now_usec() - start;
+    return move;
+}
+
+/* What the workers share. Everything but "next_game" and "stop" is
+ * protected by "mutex". */
+struct Arena {
+    EngineSpec engines[2];
+    std::vector<Opening> openings;
+    int opening_plies;  /* random moves played from each opening */
+    int max_plies;      /* a game that lasts this long is a draw */
+    int games;
+
+    std::atomic<int> next_game;
+    std::atomic<bool> stop;
+
+    /* "elo0" and "elo1" are the hypotheses of the SPRT, in Elo points
+     * for the first engine; if "sprt" is false, all the games are played. */
+    bool sprt;
+    double elo0, elo1;
+
+    std::mutex mutex;
+    int wins, draws, losses;  /* for engines[0] */
+    long plies;
+    unsigned long nodes[2];
+    long usec[2], depth[2], searches[2];
+};
+
+/* The expected score of a player who is "elo" points better. */
+static double expected_score(double elo)
+{
+    return 1.0 / (1.0 + pow(10.0, -elo / 400.0));
+}
+
+static double elo_of_score(double score)
+{
+    score = std::min(std::max(score, 1e-6), 1 - 1e-6);
+    return -400.0 * log10(1.0 / score - 1.0);
+}
+
+/* The first engine's mean score per game, and the variance of a game's
+ * score. The variance is taken with one more win and one more loss than
+ * were played, as a prior; otherwise, while every game had the same
+ * result, it would be zero, and a lopsided match could neither stop the
+ * SPRT nor get any error bars. */
+static void score_statistics(int wins, int draws, int losses, double &mean, double &variance)
+{
+    const int n = wins + draws + losses;
+    mean = (n == 0) ? 0.5 : (wins + 0.5 * draws) / n;
+    const double m = (wins + 1 + 0.5 * draws) / (n + 2);
+    variance = ((wins + 1) * (1 - m) * (1 - m) +
+                draws * (0.5 - m) * (0.5 - m) +
+                (losses + 1) * m * m) / (n + 2);
+}
+
+/* The log-likelihood ratio of the results so far, of the first engine
+ * being "elo1" points better rather than "elo0" points better, using the
+ * usual normal approximation (the "GSPRT"). */
+static double log_likelihood_ratio(int wins, int draws, int losses, double elo0, double elo1)
+{
+    const int n = wins + draws + losses;
+    if (n == 0) return 0;
+    double mean, variance;
+    score_statistics(wins, draws, losses, mean, variance);
+    const double s0 = expected_score(elo0);
+    const double s1 = expected_score(elo1);
+    return n * (s1 - s0) * (2 * mean - s0 - s1) / (2 * variance);
+}
+
+/* With both error rates at 5%, the SPRT accepts the first hypothesis
+ * once the ratio falls below log(0.05/0.95), and the second once it
+ * rises above log(0.95/0.05). */
+static const double SPRT_LOWER = log(0.05 / 0.95);
+static const double SPRT_UPPER = log(0.95 / 0.05);
+
+/* Set up "board" for game "g": opening g/2, followed by the same random
+ * moves for both games of the pair. Try other random moves if they end
+ * the game, up to OPENING_TRIES times, and then give up and return false. */
+static const int OPENING_TRIES = 1000;
+
+static bool opening_position(const Arena &arena, int g, Board &board)
+{
+    const Opening &o = arena.openings[(g / 2) % arena.openings.size()];
+    uint64_t rng = 0x9e3779b97f4a7c15ULL * (g / 2 + 1);
+    for (int tries = 0; tries < OPENING_TRIES; ++tries) {
+        board = Board(o.layout.c_str(), o.attacker);
+        int i = 0;
+        for ( ; i < arena.opening_plies; ++i) {
+            MoveList moves;
+            board.find_all_moves(moves);
+            if (moves.size == 0) break;
+            Board::Undo unused;
+            board.apply_move(moves.moves[random_number(rng) % moves.size], unused);
+        }
+        MoveList moves;
+        board.find_all_moves(moves);
+        if (i == arena.opening_plies && moves.size != 0)
+          return true;
+    }
+    return false;
+}
+
+static void worker(Arena &arena, int id)
+{
+    Engine first(arena.engines[0], 2*id + 1);
+    Engine second(arena.engines[1], 2*id + 2);
+    Engine *engines[2] = { &first, &second };
+
+    while (!arena.stop.load()) {
+        const int g = arena.next_game.fetch_add(1);
+        if (g >= arena.games) break;
+
+        Board board;
+        if (!opening_position(arena, g, board)) {
+            std::lock_guard<std::mutex> lock(arena.mutex);
+            printf("Every line of %d random plies from opening %d ends the game; stopping.\n",
+                   arena.opening_plies, (int)((g / 2) % arena.openings.size()) + 1);
+            arena.stop.store(true);
+            break;
+        }
+        /* In even games, the first engine moves first. */
+        const Player first_side = (Player)((board.attacker + g) % 2);
+        first.new_game();
+        second.new_game();
+        int winner = -1;
+        int plies = 0;
+        bool abandoned = false;
+        for ( ; plies < arena.max_plies; ++plies) {
+            /* Once the SPRT has made up its mind, any games still being
+             * played would only muddy its verdict. */
+            if (arena.stop.load()) {
+                abandoned = true;
+                break;
+            }
+            MoveList legal;
+            board.find_all_moves(legal);
+            if (legal.size == 0) {
+                winner = (board.attacker == WHITE) ? BLACK : WHITE;
+                break;
+            }
+            Engine &engine = *engines[board.attacker != first_side];
+            const PackedMove move = engine.choose(board);
+            Board::Undo unused;
+            board.apply_move(move, unused);
+        }
+
+        if (abandoned) break;
+
+        std::lock_guard<std::mutex> lock(arena.mutex);
+        const char *result;
+        if (winner == -1) {
+            arena.draws += 1;
+            result = "drew";
+        } else if (winner == first_side) {
+            arena.wins += 1;
+            result = "won";
+        } else {
+            arena.losses += 1;
+            result = "lost";
+        }
+        arena.plies += plies;
+        printf("game %4d: %s as %s %s after %d plies; +%d =%d -%d\n", g+1,
+               arena.engines[0].name.c_str(), (first_side == WHITE) ? "white" : "black",
+               result, plies, arena.wins, arena.draws, arena.losses);
+        fflush(stdout);
+        if (arena.sprt) {
+            const double llr = log_likelihood_ratio(arena.wins, arena.draws, arena.losses,
+                                                    arena.elo0, arena.elo1);
+            if (llr <= SPRT_LOWER || llr >= SPRT_UPPER)
+              arena.stop.store(true);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(arena.mutex);
+    for (int i=0; i < 2; ++i) {
+        arena.nodes[i] += engines[i]->nodes;
+        arena.usec[i] += engines[i]->usec;
+        arena.depth[i] += engines[i]->depth;
+        arena.searches[i] += engines[i]->searches;
+    }
+}
+
+static void report(const Arena &arena)
+{
+    const int n = arena.wins + arena.draws + arena.losses;
+    if (n == 0) return;
+    double mean, variance;
+    score_statistics(arena.wins, arena.draws, arena.losses, mean, variance);
+    /* A 95% confidence interval, turned into Elo. */
+    const double margin = 1.96 * sqrt(variance / n);
+    printf("\n%s vs %s: %d games, +%d =%d -%d, scoring %.1f%%\n",
+           arena.engines[0].name.c_str(), arena.engines[1].name.c_str(),
+           n, arena.wins, arena.draws, arena.losses, 100.0 * mean);
+    printf("Elo difference: %+.0f (95%% interval %+.0f to %+.0f)\n", elo_of_score(mean),
+           elo_of_score(mean - margin), elo_of_score(mean + margin));
+    printf("average game length: %.1f plies\n", (double)arena.plies / n);
+    for (int i=0; i < 2; ++i) {
+        printf("%-16s %12.0f %s per second", arena.engines[i].name.c_str(),
+               arena.usec[i] ? arena.nodes[i] / (arena.usec[i] / 1e6) : 0.0,
+               (arena.engines[i].kind == MCTS) ? "playouts" : "nodes");
+        if (arena.searches[i] != 0)
+          printf(", average depth %.2f", (double)arena.depth[i] / arena.searches[i]);
+        printf("\n");
+    }
+    if (arena.sprt) {
+        const double llr = log_likelihood_ratio(arena.wins, arena.draws, arena.losses,
+                                                arena.elo0, arena.elo1);
+        printf("SPRT elo0=%g elo1=%g: LLR %.2f (%.2f, %.2f): %s\n", arena.elo0, arena.elo1,
+               llr, SPRT_LOWER, SPRT_UPPER,
+               (llr >= SPRT_UPPER) ? "H1 accepted" :
+               (llr <= SPRT_LOWER) ? "H0 accepted" : "inconclusive");
+    }
+}
+
+/* Read openings from "filename": one per line, the side to move ("white"
+ * or "black") followed by the layout as for Board::Board(), i.e., 100
+ * characters, with whitespace ignored. Blank lines and lines starting
+ * with '#' are skipped. */
+static bool read_openings(const char *filename, std::vector<Opening> &openings)
+{
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL) {
+        printf("Can't open '%s'.\n", filename);
+        return false;
+    }
+    char line[1024];
+    int lineno = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof line, fp) != NULL) {
+        lineno += 1;
+        const char *p = line;
+        while (isspace(*p)) ++p;
+        if (*p == '\0' || *p == '#') continue;
+        Opening o;
+        if (strncmp(p, "white", 5) == 0) o.attacker = WHITE;
+        else if (strncmp(p, "black", 5) == 0) o.attacker = BLACK;
+        else ok = false;
+        int white = 0, black = 0;
+        for (p += 5; ok && *p != '\0'; ++p) {
+            if (isspace(*p)) continue;
+            if (strchr("MLE", *p)) white += 1;
+            else if (strchr("mle", *p)) black += 1;
+            else if (*p != '.') ok = false;
+            o.layout += *p;
+        }
+        if (!ok || o.layout.size() != 100 || white != 6 || black != 6) {
+            printf("%s:%d: expected 'white' or 'black' and a layout of 100 squares.\n",
+                   filename, lineno);
+            ok = false;
+            break;
+        }
+        MoveList moves;
+        Board(o.layout.c_str(), o.attacker).find_all_moves(moves);
+        if (moves.size == 0) {
+            printf("%s:%d: the game is already over.\n", filename, lineno);
+            ok = false;
+            break;
+        }
+        openings.push_back(o);
+    }
+    fclose(fp);
+    if (ok && openings.empty()) {
+        printf("'%s' has no openings in it.\n", filename);
+        ok = false;
+    }
+    return ok;
+}
+
+static bool parse_engine(const char *arg, long default_usec, EngineSpec &spec)
+{
+    spec.name = arg;
+    const char *colon = strchr(arg, ':');
+    const std::string kind = colon ? std::string(arg, colon) : std::string(arg);
+    spec.usec = default_usec;
+    if (colon != NULL) {
+        if (atoi(colon+1) < 1) return false;
+        spec.usec = 1000L * atoi(colon+1);
+    }
+    for (int i=0; i < num_engine_kinds; ++i) {
+        if (kind == engine_kinds[i].name) {
+            spec.kind = engine_kinds[i].kind;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void usage()
+{
+    puts("Usage: barca_arena [options] ENGINE1 ENGINE2");
+    puts("An ENGINE is default, full-width, no-quiescence, no-solver, mcts or random,");
+    puts("optionally followed by :MS for its time per move.");
+    puts("Options: --games N         play at most N games (default 100)");
+    puts("         --threads N       play N games at a time (default: one per core)");
+    puts("         --time MS         time per move (default 100)");
+    puts("         --openings FILE   openings to start from (default: the starting position)");
+    puts("         --random-plies N  random moves to play from each opening (default 4)");
+    puts("         --max-plies N     a game this long is a draw (default 200)");
+    puts("         --sprt ELO0 ELO1  stop once ENGINE1 is shown to be ELO0 or ELO1 Elo better");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    Arena arena;
+    arena.openings.clear();
+    arena.opening_plies = 4;
+    arena.max_plies = 200;
+    arena.games = 100;
+    arena.next_game = 0;
+    arena.stop = false;
+    arena.sprt = false;
+    arena.elo0 = arena.elo1 = 0;
+    arena.wins = arena.draws = arena.losses = 0;
+    arena.plies = 0;
+    for (int i=0; i < 2; ++i) {
+        arena.nodes[i] = 0;
+        arena.usec[i] = arena.depth[i] = arena.searches[i] = 0;
+    }
+    int threads = std::max((int)std::thread::hardware_concurrency(), 1);
+    long usec = 100*1000;
+
+    std::vector<const char *> engines;
+    for (int i=1; i < argc; ++i) {
+        if (strcmp(argv[i], "--games") == 0 && i+1 < argc && atoi(argv[i+1]) >= 1) {
+            arena.games = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && i+1 < argc && atoi(argv[i+1]) >= 1) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--time") == 0 && i+1 < argc && atoi(argv[i+1]) >= 1) {
+            usec = 1000L * atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--openings") == 0 && i+1 < argc) {
+            if (!read_openings(argv[++i], arena.openings)) exit(1);
+        } else if (strcmp(argv[i], "--random-plies") == 0 && i+1 < argc && atoi(argv[i+1]) >= 0) {
+            arena.opening_plies = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--max-plies") == 0 && i+1 < argc && atoi(argv[i+1]) >= 1) {
+            arena.max_plies = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--sprt") == 0 && i+2 < argc) {
+            arena.sprt = true;
+            arena.elo0 = atof(argv[++i]);
+            arena.elo1 = atof(argv[++i]);
+            if (arena.elo1 <= arena.elo0) usage();
+        } else if (argv[i][0] == '-') {
+            usage();
+        } else {
+            engines.push_back(argv[i]);
+        }
+    }
+    if (engines.size() != 2) usage();
+    for (int i=0; i < 2; ++i) {
+        if (!parse_engine(engines[i], usec, arena.engines[i])) usage();
+    }
+    if (arena.openings.empty()) {
+        Opening o = { start_layout, BLACK };
+        arena.openings.push_back(o);
+    }
+
+    std::vector<std::thread> workers;
+    for (int i=0; i < threads; ++i) {
+        workers.push_back(std::thread(worker, std::ref(arena), i));
+    }
+    for (int i=0; i < threads; ++i) {
+        workers[i].join();
+    }
+    report(arena);
+    return 0;
+}
@@ -0,0 +1,840 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <atomic>
+#include <new>
+#include <vector>
+#include "AlphaBeta.hh"
+#include "Board.h"
+#include "Search.h"
+
+/* Count every heap allocation in the program, for the "allocs" mode. */
+static std::atomic<unsigned long> allocations(0);
+
+void *operator new(size_t n)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void *p = malloc(n ? n : 1);
+    if (p == NULL) throw std::bad_alloc();
+    return p;
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+static int plain_evaluate(const Board &board) { return board.score(); }
+static void plain_make(Board &board, const PackedMove &move, Board::Undo &undo) { board.apply_move(move, undo); }
+static void plain_unmake(Board &board, const PackedMove &move, const Board::Undo &undo) { board.unapply_move(move, undo); }
+static void plain_findmoves(const Board &board, std::vector<PackedMove> &allmoves)
+{
+    MoveList moves;
+    board.find_all_moves(moves);
+    allmoves.assign(moves.moves, moves.moves + moves.size);
+}
+static int plain_findattacker(const Board &board) { return board.attacker; }
+static uint64_t plain_findhash(const Board &board) { return board.hash; }
+static int plain_classify(const Board &board, const PackedMove &move) { return board.tactical_value(move); }
+static int plain_move_index(const PackedMove &move) { return 100*move.from() + move.to(); }
+
+typedef AlphaBeta<Board, PackedMove, int, Board::Undo> PointerSearch;
+
+/* The same search as "ab", but with no move ordering
+ * beyond trying the transposition table's move first. */
+static TranspositionTable<PackedMove, int> plain_tt(18);
+static PointerSearch plain(plain_evaluate, plain_make, plain_unmake,
+                           plain_findmoves, plain_findattacker,
+                           plain_findhash, &plain_tt);
+
+/* Exactly the same search as "ab", but calling the Board through
+ * function pointers rather than BarcaHooks. */
+static TranspositionTable<PackedMove, int> pointers_tt(18);
+static PointerSearch pointers(plain_evaluate, plain_make, plain_unmake,
+                              plain_findmoves, plain_findattacker,
+                              plain_findhash, &pointers_tt,
+                              plain_classify, plain_move_index, BARCA_HISTORY_SIZE);
+
+struct BenchPosition {
+    const char *name;
+    Player attacker;
+    const char *layout;
+};
+
+static const BenchPosition positions[] = {
+    { "start", BLACK,
+      "....EE...."
+      "...LMML..."
+      ".........."
+      ".........."
+      ".........."
+      ".........."
+      ".........."
+      ".........."
+      "...lmml..."
+      "....ee...." },
+    { "middle1", WHITE,
+      "...E.E...."
+      ".....M...."
+      ".........L"
+      ".........."
+      "......L..."
+      "....M....."
+      "....m..e.."
+      "....l....."
+      "....m.l..."
+      ".....e...." },
+    { "middle2", BLACK,
+      ".....E...."
+      ".........."
+      "....M..L.."
+      ".........E"
+      "e........."
+      "l....M...."
+      "........L."
+      ".m........"
+      ".....ml..."
+      "........e." },
+    { "middle3", BLACK,
+      ".........."
+      "...LM....."
+      ".......E.."
+      "....m....."
+      ".....M...."
+      "l..l......"
+      ".L..e....."
+      ".........."
+      ".m.......E"
+      "....e....." },
+};
+
+static const int num_positions = sizeof positions / sizeof positions[0];
+
+static double seconds_since(const struct timeval &start)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - start.tv_sec) + 1e-6 * ((int)now.tv_usec - (int)start.tv_usec);
+}
+
+/* Compare the number of nodes visited by plain minimax, by alpha-beta,
+ * and by alpha-beta with a (freshly cleared) transposition table, at
+ * each ply. Minimax and alpha-beta must agree on the value of the root;
+ * the transposition table may legitimately change the value, since it
+ * lets a position reached with N plies to go reuse a deeper result.
+ * Plain minimax gets expensive very quickly, so it is run only up to
+ * "minimax_maxply". */
+static void compare(int maxply, int minimax_maxply)
+{
+    TranspositionTable<PackedMove, int> *tt = ab.transposition_table();
+    printf("%-8s %3s %12s %12s %12s %8s %8s\n",
+           "position", "ply", "minimax", "alphabeta", "with TT", "ratio", "seconds");
+    for (int i=0; i < num_positions; ++i) {
+        Board board(positions[i].layout, positions[i].attacker);
+        for (int ply = 1; ply <= maxply; ++ply) {
+            PackedMove mm_move, ab_move, tt_move;
+            int mm_value = 0, ab_value = 0, tt_value = 0;
+            unsigned long mm_nodes = 0, ab_nodes;
+            ab.set_transposition_table(NULL);
+            if (ply <= minimax_maxply) {
+                ab.nodes = 0;
+                ab.depth_first(board, ply, mm_move, mm_value);
+                mm_nodes = ab.nodes;
+            }
+            ab.nodes = 0;
+            ab.depth_first_alpha_beta(board, ply, ab_move, ab_value,
+                                      /*alpha=*/-9999, /*beta=*/+9999);
+            ab_nodes = ab.nodes;
+            if (ply <= minimax_maxply && mm_value != ab_value) {
+                printf("MISMATCH: minimax says %d, alphabeta says %d\n",
+                       mm_value, ab_value);
+                exit(1);
+            }
+
+            ab.set_transposition_table(tt);
+            ab.forget();
+            struct timeval start;
+            gettimeofday(&start, NULL);
+            ab.nodes = 0;
+            ab.depth_first_alpha_beta(board, ply, tt_move, tt_value,
+                                      /*alpha=*/-9999, /*beta=*/+9999);
+            double elapsed = seconds_since(start);
+
+            if (ply <= minimax_maxply) {
+                printf("%-8s %3d %12lu %12lu %12lu %8.1f %8.3f\n", positions[i].name,
+                       ply, mm_nodes, ab_nodes, ab.nodes, (double)mm_nodes / ab.nodes, elapsed);
+            } else {
+                printf("%-8s %3d %12s %12lu %12lu %8s %8.3f\n", positions[i].name,
+                       ply, "-", ab_nodes, ab.nodes, "-", elapsed);
+            }
+        }
+    }
+}
+
+/* Search "board" with iterative deepening, as find_best_move() does,
+ * and report the nodes visited at each ply and how often the first
+ * move tried caused the cutoff. */
+template<class Engine>
+static void search_and_report(Engine &engine, const char *position, const char *name,
+                              const Board &board, int maxply)
+{
+    engine.forget();
+    engine.reset_stats();
+    engine.nodes = 0;
+    struct timeval start;
+    gettimeofday(&start, NULL);
+    for (int ply = 1; ply <= maxply; ++ply) {
+        PackedMove move;
+        int value;
+        engine.depth_first_alpha_beta(board, ply, move, value,
+                                      /*alpha=*/-9999, /*beta=*/+9999);
+    }
+    printf("%-8s %-15s %10lu nodes %7.3fs  first-move cutoffs %5.1f%%  per ply:",
+           position, name, engine.nodes, seconds_since(start),
+           engine.stats.cutoffs ? 100.0 * engine.stats.first_move_cutoffs / engine.stats.cutoffs : 0.0);
+    for (int h=0; h < (int)engine.stats.nodes_at_height.size(); ++h) {
+        printf(" %lu", engine.stats.nodes_at_height[h]);
+    }
+    printf("\n");
+}
+
+/* Search each position once with only the hash move ordered first and
+ * once with the full move ordering; and once more with the full move
+ * ordering but through function pointers, which should visit the same
+ * nodes as "ab", only more slowly. */
+static void ordering(int maxply)
+{
+    for (int i=0; i < num_positions; ++i) {
+        Board board(positions[i].layout, positions[i].attacker);
+        search_and_report(plain, positions[i].name, "hash move only", board, maxply);
+        search_and_report(ab, positions[i].name, "full ordering", board, maxply);
+        search_and_report(pointers, positions[i].name, "via pointers", board, maxply);
+    }
+}
+
+/* Measure time-to-depth: how long iterative deepening with 1, 2, ...,
+ * "maxthreads" threads takes to complete "ply" plies on each position,
+ * starting from an empty transposition table each time. Lazy SMP visits
+ * more nodes in total as threads are added, so the time is what counts. */
+static void smp(int maxthreads, int ply)
+{
+    printf("%-8s %7s %12s %8s %8s %6s\n",
+           "position", "threads", "nodes", "seconds", "speedup", "value");
+    for (int i=0; i < num_positions; ++i) {
+        Board board(positions[i].layout, positions[i].attacker);
+        double serial = 0;
+        for (int threads = 1; threads <= maxthreads; ++threads) {
+            PackedMove move;
+            int value;
+            ab.forget();
+            ab.nodes = 0;
+            struct timeval start;
+            gettimeofday(&start, NULL);
+            ab.parallel_iterative_deepening(board, threads, ply, 0, move, value,
+                                            /*alpha=*/-9999, /*beta=*/+9999, /*aspiration=*/5);
+            double elapsed = seconds_since(start);
+            if (threads == 1) serial = elapsed;
+            printf("%-8s %7d %12lu %8.3f %8.2f %6d\n", positions[i].name,
+                   threads, ab.nodes, elapsed, serial / elapsed, value);
+        }
+    }
+}
+
+/* Search each position to "ply" plies with the Young Brothers Wait
+ * search, with 1, 2, ..., "maxthreads" threads. The transposition table
+ * is first filled by a search one ply shallower, for move ordering; since
+ * the parallel search doesn't change it, every run must find the same
+ * move and value. The value must also match a plain serial alpha-beta
+ * search without the table, since neither prunes anything unsoundly. */
+static void ybw(int maxthreads, int ply)
+{
+    printf("%-8s %7s %12s %8s %8s %6s  %s\n",
+           "position", "threads", "nodes", "seconds", "speedup", "value", "move");
+    for (int i=0; i < num_positions; ++i) {
+        Board board(positions[i].layout, positions[i].attacker);
+        PackedMove move;
+        int value;
+        TranspositionTable<PackedMove, int> *tt = ab.transposition_table();
+        ab.set_transposition_table(NULL);
+        ab.depth_first_alpha_beta(board, ply, move, value, /*alpha=*/-9999, /*beta=*/+9999);
+        const int serial_value = value;
+        ab.set_transposition_table(tt);
+
+        ab.forget();
+        ab.iterative_deepening(board, ply-1, 0, move, value, -9999, +9999, /*aspiration=*/5);
+        PackedMove first_move;
+        double serial = 0;
+        for (int threads = 1; threads <= maxthreads; ++threads) {
+            ab.nodes = 0;
+            struct timeval start;
+            gettimeofday(&start, NULL);
+            ab.parallel_alpha_beta(board, ply, threads, move, value, -9999, +9999);
+            double elapsed = seconds_since(start);
+            if (threads == 1) {
+                serial = elapsed;
+                first_move = move;
+            }
+            printf("%-8s %7d %12lu %8.3f %8.2f %6d  (%d,%d) to (%d,%d)\n", positions[i].name,
+                   threads, ab.nodes, elapsed, serial / elapsed, value,
+                   square_x(move.from()), square_y(move.from()), square_x(move.to()), square_y(move.to()));
+            if (value != serial_value || !(move == first_move)) {
+                printf("MISMATCH: serial alphabeta says %d\n", serial_value);
+                exit(1);
+            }
+        }
+    }
+}
+
+/* Search each position with a time budget of "msec" milliseconds, as
+ * find_best_move() does, and report how deep it got and how close it
+ * came to the budget. */
+static void timed(int msec, int threads)
+{
+    printf("%-8s %7s %4s %8s %8s  %s\n",
+           "position", "threads", "ply", "budget", "seconds", "last ply");
+    for (int i=0; i < num_positions; ++i) {
+        Board board(positions[i].layout, positions[i].attacker);
+        PackedMove move;
+        int value;
+        ab.forget();
+        struct timeval start;
+        gettimeofday(&start, NULL);
+        const int completed = ab.parallel_iterative_deepening(board, threads, 64, 1000L * msec,
+                                  move, value, /*alpha=*/-9999, /*beta=*/+9999, /*aspiration=*/5);
+        const double elapsed = seconds_since(start);
+        printf("%-8s %7d %4d %8.3f %8.3f  %s\n", positions[i].name, threads, completed,
+               msec / 1000.0, elapsed, ab.ran_out_of_time() ? "abandoned" : "not started");
+    }
+}
+
+/* Count the heap allocations made by a fixed-depth alpha-beta search of
+ * each position, from a freshly cleared table, and by a second search
+ * of the same position once the engine has warmed up. */
+static void allocs(int ply)
+{
+    printf("%-8s %3s %12s %12s %12s %12s\n",
+           "position", "ply", "nodes", "allocations", "per node", "warm");
+    for (int i=0; i < num_positions; ++i) {
+        Board board(positions[i].layout, positions[i].attacker);
+        PackedMove move;
+        int value;
+        ab.forget();
+        ab.nodes = 0;
+        const unsigned long before = allocations;
+        ab.depth_first_alpha_beta(board, ply, move, value, /*alpha=*/-9999, /*beta=*/+9999);
+        const unsigned long cold = allocations - before;
+        const unsigned long nodes = ab.nodes;
+        ab.forget();
+        const unsigned long before_warm = allocations;
+        ab.depth_first_alpha_beta(board, ply, move, value, /*alpha=*/-9999, /*beta=*/+9999);
+        const unsigned long warm = allocations - before_warm;
+        printf("%-8s %3d %12lu %12lu %12.2f %12lu\n", positions[i].name, ply,
+               nodes, cold, (double)cold / nodes, warm);
+    }
+}
+
+/* Time-to-depth with and without the selective search: iterative
+ * deepening to "maxply" on each position, from an empty table. */
+static void selective_depth(int maxply)
+{
+    printf("%-8s %-10s %12s %6s  %s\n", "position", "search", "nodes", "value", "seconds to reach each ply");
+    for (int i=0; i < num_positions; ++i) {
+        Board board(positions[i].layout, positions[i].attacker);
+        for (int selective = 0; selective <= 1; ++selective) {
+            PackedMove move;
+            int value;
+            ab.forget();
+            ab.set_selectivity(selective, selective);
+            ab.nodes = 0;
+            ab.iterative_deepening(board, maxply, 0, move, value,
+                                   /*alpha=*/-9999, /*beta=*/+9999, /*aspiration=*/5);
+            printf("%-8s %-10s %12lu %6d ", positions[i].name,
+                   selective ? "selective" : "full-width", ab.nodes, value);
+            long total = 0;
+            for (int j=0; j < (int)ab.iterations.size(); ++j) {
+                total += ab.iterations[j].usec;
+                printf(" %.3f", total / 1e6);
+            }
+            printf("\n");
+        }
+    }
+    ab.set_selectivity(false, false);
+}
+
+/* Configure "engine" as find_best_move() does, but perhaps without
+ * one feature. */
+static void configure(BarcaSearch &engine, const char *without)
+{
+    const bool selective = (strcmp(without, "selective") != 0);
+    engine.set_selectivity(selective, selective);
+    engine.set_quiescence(strcmp(without, "quiescence") != 0 ? BARCA_QUIESCENCE_PLIES : 0);
+}
+
+/* Play "games" games with "msec" milliseconds a move between the search
+ * as find_best_move() does it (using "ab") and the same search without
+ * "feature" (using "rival"), starting from each of the positions in
+ * turn, and with each side playing each colour in turn. A game that
+ * lasts MAX_GAME_PLIES is a draw. Report the score and how deep each
+ * side got on average. If "feature" is "mcts", then "ab" is replaced
+ * by single-threaded Monte Carlo tree search, which has no depth. */
+static TranspositionTable<PackedMove, int> rival_tt(18);
+static BarcaSearch rival(&rival_tt, BARCA_HISTORY_SIZE);
+enum { MAX_GAME_PLIES = 120 };
+
+static void selfplay(int games, int msec, const char *feature)
+{
+    int wins = 0, losses = 0, draws = 0;
+    long depth[2] = {0, 0}, moves[2] = {0, 0};
+    configure(ab, "");
+    configure(rival, feature);
+    for (int g=0; g < games; ++g) {
+        const BenchPosition &start = positions[g % num_positions];
+        const Player our_side = (Player)((g / num_positions + start.attacker) % 2);
+        Board board(start.layout, start.attacker);
+        ab.forget();
+        rival.forget();
+        mcts.clear();
+        int winner = -1;
+        int plies = 0;
+        for ( ; plies < MAX_GAME_PLIES; ++plies) {
+            MoveList legal;
+            board.find_all_moves(legal);
+            if (legal.size == 0) {
+                winner = (board.attacker == WHITE) ? BLACK : WHITE;
+                break;
+            }
+            const bool ours = (board.attacker == our_side);
+            PackedMove move;
+            if (ours && strcmp(feature, "mcts") == 0) {
+                mcts.search(board, 1, 1000L * msec, move);
+            } else {
+                BarcaSearch &engine = ours ? ab : rival;
+                int value;
+                engine.new_search();
+                const int completed = engine.iterative_deepening(board, 64, 1000L * msec, move, value,
+                                          /*alpha=*/-9999, /*beta=*/+9999, /*aspiration=*/5);
+                depth[ours] += completed;
+                moves[ours] += 1;
+            }
+            Board::Undo unused;
+            board.apply_move(move, unused);
+        }
+        const char *result = (winner == -1) ? "draw" :
+                             (winner == our_side) ? "won" : "lost";
+        if (winner == -1) draws += 1;
+        else if (winner == our_side) wins += 1;
+        else losses += 1;
+        printf("game %2d: %-8s with %s plays %s: %s after %d plies\n", g+1, start.name, feature,
+               (our_side == WHITE) ? "white" : "black", result, plies);
+        fflush(stdout);
+    }
+    printf("with %s %d, without %d, drawn %d: with %s scores %.1f%%\n",
+           feature, wins, losses, draws, feature,
+           games ? 100.0 * (wins + 0.5 * draws) / games : 0.0);
+    printf("average alpha-beta depth: with %.2f, without %.2f\n",
+           moves[1] ? (double)depth[1] / moves[1] : 0.0,
+           moves[0] ? (double)depth[0] / moves[0] : 0.0);
+    configure(ab, "selective");
+    ab.set_quiescence(0);
+}
+
+/* Play a game from each position with "msec" milliseconds a move, as
+ * find_best_move() would but without the solver; and before each move,
+ * try to prove a forced win with at most "maxnodes" nodes of the
+ * proof-number search. Report the moves at which either of them first
+ * saw the win coming. */
+static void prove(unsigned long maxnodes, int msec)
+{
+    configure(ab, "");
+    printf("%-8s %5s %-5s %12s %8s %8s  %s\n",
+           "position", "ply", "side", "solver nodes", "seconds", "result", "alpha-beta");
+    for (int i=0; i < num_positions; ++i) {
+        Board board(positions[i].layout, positions[i].attacker);
+        ab.forget();
+        solver.clear();
+        for (int ply = 0; ply < MAX_GAME_PLIES; ++ply) {
+            MoveList legal;
+            board.find_all_moves(legal);
+            if (legal.size == 0) {
+                printf("%-8s %5d %-5s game over\n", positions[i].name, ply,
+                       (board.attacker == WHITE) ? "white" : "black");
+                break;
+            }
+            PackedMove move;
+            struct timeval start;
+            gettimeofday(&start, NULL);
+            solver.nodes = 0;
+            const BarcaProofSearch::Result result = solver.prove(board, maxnodes, move);
+            const double elapsed = seconds_since(start);
+
+            int value;
+            ab.new_search();
+            const int completed = ab.iterative_deepening(board, 64, 1000L * msec, move, value,
+                                      /*alpha=*/-9999, /*beta=*/+9999, /*aspiration=*/5);
+            if (result != BarcaProofSearch::UNKNOWN || value == 9999 || value == -9999) {
+                printf("%-8s %5d %-5s %12lu %8.3f %8s  value %d at ply %d\n", positions[i].name,
+                       ply, (board.attacker == WHITE) ? "white" : "black", solver.nodes, elapsed,
+                       (result == BarcaProofSearch::PROVEN) ? "win" :
+                       (result == BarcaProofSearch::DISPROVEN) ? "no win" : "unknown",
+                       value, completed);
+            }
+            Board::Undo unused;
+            board.apply_move(move, unused);
+        }
+    }
+    configure(ab, "selective");
+    ab.set_quiescence(0);
+}
+
+/* A tiny game for "reprove", in which each position is a number and
+ * its moves are the positions it leads to. The first player (X) moves
+ * from A, L and B; the second (Y) from Q and M; and Y, to move in W,
+ * has lost.
+ *   From A, X can go to Q, where Y can only go back to A or on to L,
+ * from which X wins; so proving A first tries Q, finds that Y draws by
+ * repeating A, and then wins through M instead. From B, X's only move
+ * is to Q, which wins, since returning to A now loses to A's own win;
+ * but only if the solver doesn't remember Q as the draw it was in the
+ * first search. */
+struct ToyHooks : AlphaBetaHooks<int, int, int, int> {
+    enum { A, Q, L, M, B, W };
+    static bool has_makemove() { return true; }
+    static bool has_hash() { return true; }
+    static int evaluate(const int &pos) { return (pos == W) ? 9999 : 0; }
+    static void makemove(int &pos, const int &move, int &undo) { undo = pos; pos = move; }
+    static void unmakemove(int &pos, const int &, const int &undo) { pos = undo; }
+    static void findmoves(const int &pos, std::vector<int> &allmoves) {
+        static const int next[6][3] = { {Q, M, -1}, {A, L, -1}, {W, -1}, {L, -1}, {Q, -1}, {-1} };
+        for (int i=0; next[pos][i] != -1; ++i) {
+            allmoves.push_back(next[pos][i]);
+        }
+    }
+    static int findattacker(const int &pos) { return (pos == Q || pos == M || pos == W); }
+    static uint64_t findhash(const int &pos) { return 0x9e3779b97f4a7c15ULL * (pos + 1); }
+};
+
+/* Check that a disproof which depended on the line that reached it
+ * doesn't outlive the prove() call that found it. */
+static void reprove()
+{
+    ProofNumberSearch<int, int, int, int, ToyHooks> toy(4, 9999);
+    static const char *results[] = { "win", "no win", "unknown" };
+    int move;
+    const int a = toy.prove(ToyHooks::A, 1000, move);
+    const int b = toy.prove(ToyHooks::B, 1000, move);
+    printf("from A: %s\nfrom B: %s\n", results[a], results[b]);
+    if (a != toy.PROVEN || b != toy.PROVEN) {
+        printf("MISMATCH: both are wins\n");
+        exit(1);
+    }
+}
+
+/* Measure playouts per second: Monte Carlo tree search of each position
+ * for "msec" milliseconds with 1, 2, ..., "maxthreads" threads, starting
+ * from an empty tree each time. */
+static void playouts(int msec, int maxthreads)
+{
+    printf("%-8s %7s %10s %12s %8s %10s  %s\n",
+           "position", "threads", "playouts", "per second", "speedup", "tree nodes", "move");
+    for (int i=0; i < num_positions; ++i) {
+        Board board(positions[i].layout, positions[i].attacker);
+        double serial = 0;
+        for (int threads = 1; threads <= maxthreads; ++threads) {
+            PackedMove move;
+            mcts.clear();
+            struct timeval start;
+            gettimeofday(&start, NULL);
+            mcts.search(board, threads, 1000L * msec, move);
+            const double rate = mcts.stats.playouts / seconds_since(start);
+            if (threads == 1) serial = rate;
+            printf("%-8s %7d %10lu %12.0f %8.2f %10lu  (%d,%d) to (%d,%d)\n", positions[i].name,
+                   threads, mcts.stats.playouts, rate, rate / serial, mcts.stats.tree_nodes,
+                   square_x(move.from()), square_y(move.from()), square_x(move.to()), square_y(move.to()));
+        }
+    }
+}
+
+/* Count the positions reachable in exactly "depth" moves from "board"
+ * (in which a won game has no moves), checking on the way that each
+ * unapply_move() puts back what apply_move() changed. */
+static unsigned long perft_count(Board &board, int depth)
+{
+    MoveList moves;
+    board.find_all_moves(moves);
+    if (depth == 1)
+      return moves.size;
+    unsigned long leaves = 0;
+    const uint64_t hash = board.hash;
+    for (int i=0; i < moves.size; ++i) {
+        Board::Undo undo;
+        board.apply_move(moves.moves[i], undo);
+        leaves += perft_count(board, depth-1);
+        board.unapply_move(moves.moves[i], undo);
+        assert(board.hash == hash);
+    }
+    return leaves;
+}
+
+/* Count the leaves at each depth up to "maxdepth" from each position,
+ * which measures the move generator alone; the counts themselves must
+ * never change. The first position is the one Board() sets up. */
+static void perft(int maxdepth)
+{
+    printf("%-8s %5s %14s %8s %12s\n", "position", "depth", "leaves", "seconds", "per second");
+    for (int i=0; i < num_positions; ++i) {
+        Board board = (i == 0) ? Board() : Board(positions[i].layout, positions[i].attacker);
+        assert(i != 0 || board.hash == Board(positions[i].layout, positions[i].attacker).hash);
+        for (int depth = 1; depth <= maxdepth; ++depth) {
+            struct timeval start;
+            gettimeofday(&start, NULL);
+            const unsigned long leaves = perft_count(board, depth);
+            const double elapsed = seconds_since(start);
+            printf("%-8s %5d %14lu %8.3f %12.0f\n", positions[i].name, depth, leaves,
+                   elapsed, elapsed > 0 ? leaves / elapsed : 0.0);
+        }
+    }
+}
+
+/* Search each position to "ply" plies, as find_best_move() does but on
+ * one thread and from an empty table, and report the total nodes and
+ * their speed. The search is deterministic, so the signature (a hash of
+ * every position's node count, value and move) must stay the same
+ * across changes that are meant only to make it faster. */
+static void bench(int ply)
+{
+    configure(ab, "");
+    printf("%-8s %12s %6s %8s  %s\n", "position", "nodes", "value", "seconds", "move");
+    unsigned long total = 0;
+    double elapsed = 0;
+    uint64_t signature = 0xcbf29ce484222325ULL;
+    for (int i=0; i < num_positions; ++i) {
+        Board board(positions[i].layout, positions[i].attacker);
+        PackedMove move;
+        int value;
+        ab.forget();
+        ab.nodes = 0;
+        struct timeval start;
+        gettimeofday(&start, NULL);
+        ab.iterative_deepening(board, ply, 0, move, value,
+                               /*alpha=*/-9999, /*beta=*/+9999, /*aspiration=*/5);
+        const double seconds = seconds_since(start);
+        printf("%-8s %12lu %6d %8.3f  (%d,%d) to (%d,%d)\n", positions[i].name,
+               ab.nodes, value, seconds,
+               square_x(move.from()), square_y(move.from()), square_x(move.to()), square_y(move.to()));
+        total += ab.nodes;
+        elapsed += seconds;
+        const uint64_t words[3] = { ab.nodes, (uint64_t)(int64_t)value, move.bits };
+        for (int w=0; w < 3; ++w) {
+            signature = (signature ^ words[w]) * 0x100000001b3ULL;
+        }
+    }
+    printf("total nodes %lu in %.3fs: %.0f nodes per second\n", total, elapsed,
+           elapsed > 0 ? total / elapsed : 0.0);
+    printf("signature %016llx\n", (unsigned long long)signature);
+    configure(ab, "selective");
+    ab.set_quiescence(0);
+}
+
+/* Run the breadth-first search of each position with "maxnodes" nodes,
+ * and report its speed, how many heap allocations it made, and how many
+ * times it pushed or popped its queue. Then run the level-by-level
+ * parallel version with 1, 2, ..., "maxthreads" threads, which must
+ * build the same tree and so find the same value. */
+static void breadth(int maxnodes, int maxthreads)
+{
+    printf("%-8s %-8s %10s %8s %12s %12s %12s %6s  %s\n", "position", "threads",
+           "nodes", "seconds", "per second", "allocations", "queue ops", "value", "move");
+    for (int i=0; i < num_positions; ++i) {
+        Board board(positions[i].layout, positions[i].attacker);
+        int serial_value = 0;
+        unsigned long serial_nodes = 0;
+        for (int threads = 0; threads <= maxthreads; ++threads) {
+            PackedMove move;
+            int value;
+            ab.nodes = 0;
+            ab.reset_stats();
+            const unsigned long before = allocations;
+            struct timeval start;
+            gettimeofday(&start, NULL);
+            if (threads == 0)
+              ab.breadth_first(board, maxnodes, move, value);
+            else
+              ab.parallel_breadth_first(board, threads, maxnodes, move, value);
+            const double elapsed = seconds_since(start);
+            char name[16];
+            snprintf(name, sizeof name, threads ? "%d" : "serial", threads);
+            printf("%-8s %-8s %10lu %8.3f %12.0f %12lu %12lu %6d  (%d,%d) to (%d,%d)\n", positions[i].name,
+                   name, ab.nodes, elapsed, ab.nodes / elapsed, allocations - before,
+                   ab.stats.queue_operations, value,
+                   square_x(move.from()), square_y(move.from()), square_x(move.to()), square_y(move.to()));
+            if (threads == 0) {
+                serial_value = value;
+                serial_nodes = ab.nodes;
+            } else if (value != serial_value || ab.nodes != serial_nodes) {
+                printf("MISMATCH: breadth_first() says %d in %lu nodes\n", serial_value, serial_nodes);
+                exit(1);
+            }
+        }
+    }
+}
+
+/* Compare scoring every move of a position one at a time (applying the
+ * move, calling score(), and taking it back) with scoring them all at once
+ * with score_moves(), which must agree, over the stored positions and the
+ * positions of a few seeded random games from each. Report how many
+ * boards per second each way scores, over "reps" passes. */
+static void scoring(int reps)
+{
+    std::vector<Board> boards;
+    for (int i=0; i < num_positions; ++i) {
+        srand(i + 1);
+        Board board(positions[i].layout, positions[i].attacker);
+        for (int ply = 0; ply < MAX_GAME_PLIES; ++ply) {
+            MoveList moves;
+            board.find_all_moves(moves);
+            if (moves.size == 0) break;
+            boards.push_back(board);
+            Board::Undo unused;
+            board.apply_move(moves.moves[rand() % moves.size], unused);
+        }
+    }
+    std::vector<MoveList> moves(boards.size());
+    unsigned long total = 0;
+    for (int b=0; b < (int)boards.size(); ++b) {
+        boards[b].find_all_moves(moves[b]);
+        total += moves[b].size;
+    }
+
+    long checksum[2] = {0, 0};
+    double elapsed[2];
+    for (int batch = 0; batch <= 1; ++batch) {
+        struct timeval start;
+        gettimeofday(&start, NULL);
+        for (int rep = 0; rep < reps; ++rep) {
+            for (int b=0; b < (int)boards.size(); ++b) {
+                int values[MoveList::CAPACITY];
+                if (batch) {
+                    boards[b].score_moves(moves[b].moves, moves[b].size, values);
+                } else {
+                    for (int i=0; i < moves[b].size; ++i) {
+                        Board::Undo undo;
+                        boards[b].apply_move(moves[b].moves[i], undo);
+                        values[i] = boards[b].score();
+                        boards[b].unapply_move(moves[b].moves[i], undo);
+                    }
+                }
+                for (int i=0; i < moves[b].size; ++i) {
+                    checksum[batch] = 31 * checksum[batch] + values[i];
+                }
+            }
+        }
+        elapsed[batch] = seconds_since(start);
+    }
+    printf("%lu positions, %lu boards after their moves, %d passes\n",
+           (unsigned long)boards.size(), total, reps);
+    printf("one at a time: %8.3fs, %12.0f boards per second\n",
+           elapsed[0], reps * total / elapsed[0]);
+    printf("all at once:   %8.3fs, %12.0f boards per second (%.2fx)\n",
+           elapsed[1], reps * total / elapsed[1], elapsed[0] / elapsed[1]);
+    if (checksum[0] != checksum[1]) {
+        printf("MISMATCH: score_moves() disagrees with score()\n");
+        exit(1);
+    }
+}
+
+static void usage()
+{
+    puts("Usage: barca_bench compare [maxply [minimax_maxply]]");
+    puts("       barca_bench ordering [maxply]");
+    puts("       barca_bench smp [maxthreads [ply]]");
+    puts("       barca_bench ybw [maxthreads [ply]]");
+    puts("       barca_bench allocs [ply]");
+    puts("       barca_bench timed [msec [threads]]");
+    puts("       barca_bench selective [maxply]");
+    puts("       barca_bench selfplay [games [msec [selective|quiescence|mcts]]]");
+    puts("       barca_bench prove [maxnodes [msec]]");
+    puts("       barca_bench reprove");
+    puts("       barca_bench playouts [msec [maxthreads]]");
+    puts("       barca_bench perft [depth]");
+    puts("       barca_bench bench [ply]");
+    puts("       barca_bench breadth [maxnodes [maxthreads]]");
+    puts("       barca_bench scoring [reps]");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) usage();
+    if (strcmp(argv[1], "compare") == 0) {
+        int maxply = (argc > 2) ? atoi(argv[2]) : 5;
+        int minimax_maxply = (argc > 3) ? atoi(argv[3]) : 3;
+        if (maxply < 1) usage();
+        compare(maxply, minimax_maxply);
+    } else if (strcmp(argv[1], "ordering") == 0) {
+        int maxply = (argc > 2) ? atoi(argv[2]) : 6;
+        if (maxply < 1) usage();
+        ordering(maxply);
+    } else if (strcmp(argv[1], "smp") == 0) {
+        int maxthreads = (argc > 2) ? atoi(argv[2]) : 4;
+        int ply = (argc > 3) ? atoi(argv[3]) : 6;
+        if (maxthreads < 1 || ply < 1) usage();
+        smp(maxthreads, ply);
+    } else if (strcmp(argv[1], "ybw") == 0) {
+        int maxthreads = (argc > 2) ? atoi(argv[2]) : 4;
+        int ply = (argc > 3) ? atoi(argv[3]) : 5;
+        if (maxthreads < 1 || ply < 2) usage();
+        ybw(maxthreads, ply);
+    } else if (strcmp(argv[1], "allocs") == 0) {
+        int ply = (argc > 2) ? atoi(argv[2]) : 6;
+        if (ply < 1) usage();
+        allocs(ply);
+    } else if (strcmp(argv[1], "timed") == 0) {
+        int msec = (argc > 2) ? atoi(argv[2]) : 2000;
+        int threads = (argc > 3) ? atoi(argv[3]) : 1;
+        if (msec < 1 || threads < 1) usage();
+        timed(msec, threads);
+    } else if (strcmp(argv[1], "selective") == 0) {
+        int maxply = (argc > 2) ? atoi(argv[2]) : 7;
+        if (maxply < 1) usage();
+        selective_depth(maxply);
+    } else if (strcmp(argv[1], "selfplay") == 0) {
+        int games = (argc > 2) ? atoi(argv[2]) : 8;
+        int msec = (argc > 3) ? atoi(argv[3]) : 100;
+        const char *feature = (argc > 4) ? argv[4] : "selective";
+        if (games < 1 || msec < 1) usage();
+        if (strcmp(feature, "selective") != 0 && strcmp(feature, "quiescence") != 0 &&
+            strcmp(feature, "mcts") != 0) usage();
+        selfplay(games, msec, feature);
+    } else if (strcmp(argv[1], "prove") == 0) {
+        long maxnodes = (argc > 2) ? atol(argv[2]) : BARCA_PROOF_NODES;
+        int msec = (argc > 3) ? atoi(argv[3]) : 100;
+        if (maxnodes < 1 || msec < 1) usage();
+        prove(maxnodes, msec);
+    } else if (strcmp(argv[1], "reprove") == 0) {
+        reprove();
+    } else if (strcmp(argv[1], "playouts") == 0) {
+        int msec = (argc > 2) ? atoi(argv[2]) : 1000;
+        int maxthreads = (argc > 3) ? atoi(argv[3]) : 4;
+        if (msec < 1 || maxthreads < 1) usage();
+        playouts(msec, maxthreads);
+    } else if (strcmp(argv[1], "perft") == 0) {
+        int depth = (argc > 2) ? atoi(argv[2]) : 4;
+        if (depth < 1) usage();
+        perft(depth);
+    } else if (strcmp(argv[1], "bench") == 0) {
+        int ply = (argc > 2) ? atoi(argv[2]) : 7;
+        if (ply < 1) usage();
+        bench(ply);
+    } else if (strcmp(argv[1], "breadth") == 0) {
+        int maxnodes = (argc > 2) ? atoi(argv[2]) : 1000*1000;
+        int maxthreads = (argc > 3) ? atoi(argv[3]) : 4;
+        if (maxnodes < 1 || maxthreads < 0) usage();
+        breadth(maxnodes, maxthreads);
+    } else if (strcmp(argv[1], "scoring") == 0) {
+        int reps = (argc > 2) ? atoi(argv[2]) : 100;
+        if (reps < 1) usage();
+        scoring(reps);
+    } else {
+        usage();
+    }
+    return 0;
+}
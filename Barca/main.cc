@@ -10,6 +10,7 @@
 #include "SimplePng.h"
 
 #include "Board.h"
+#include "Search.h"
 #include "process_image.h"
 
 void get_game(Board &board)
@@ -19,8 +20,26 @@ void get_game(Board &board)
     board = process_image(img.im, img.w, img.h);
 }
 
+/* Called between slices of our thinking: is "board" still the game on
+ * the screen? If somebody has started a new game, or we misread the
+ * screen last time, we may as well stop thinking about it. */
+static bool board_still_shown(const Board &board)
+{
+    Board now;
+    try {
+        get_game(now);
+    } catch (...) {
+        /* We'll find out what's going on next time round. */
+        return true;
+    }
+    return now.attacker == board.attacker && now.str() == board.str();
+}
+
 static std::set<std::string> seen_it;
 
+/* Thinks about the opponent's position while the opponent does. */
+static Ponderer ponderer;
+
 int main(int argc, char **argv)
 {
     bool play_for[WHITE+1] = {};
@@ -29,9 +48,18 @@ int main(int argc, char **argv)
             play_for[WHITE] = true;
         } else if (strcmp(argv[i], "--black") == 0) {
             play_for[BLACK] = true;
+        } else if (strcmp(argv[i], "--threads") == 0 && i+1 < argc && atoi(argv[i+1]) >= 1) {
+            search_options.threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--time") == 0 && i+1 < argc && atoi(argv[i+1]) >= 1) {
+            /* The budget for each move, in milliseconds. */
+            search_options.usec = 1000L * atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--full-width") == 0) {
+            search_options.selective = false;
+        } else if (strcmp(argv[i], "--mcts") == 0) {
+            search_options.mcts = true;
         } else {
             printf("Invalid option '%s'.\n", argv[i]);
-            puts("Valid options are: --black, --white.");
+            puts("Valid options are: --black, --white, --threads N, --time MS, --full-width, --mcts.");
         }
     }
     if (!play_for[BLACK] && !play_for[WHITE]) {
@@ -54,6 +82,11 @@ int main(int argc, char **argv)
             get_game(board);  /* This might throw. */
         } catch (const opponent_is_thinking&) {
             assert(!play_for[board.attacker]);
+            /* "board" wasn't filled in; but whatever position the
+             * opponent is thinking about, we've been pondering it
+             * since we moved. */
+            usleep(500*1000);
+            continue;
         } catch (const char *err) {
             puts("Failed to get a valid board image.");
             printf("Reason provided was: \"%s\"\n", err);
@@ -73,6 +106,7 @@ int main(int argc, char **argv)
 
         if (board.score() == +9999) {
             /* Somebody won. */
+            ponderer.stop();
             if (turns == 0) {
                 /* The board just hasn't been cleared since last time. */
                 usleep(500*1000);
@@ -105,12 +139,22 @@ int main(int argc, char **argv)
         assert(!expecting_to_win);
 
         if (!play_for[board.attacker]) {
-            puts("Attacker is not ME, so I'm going back to sleep for a while.");
+            if (!ponderer.is_pondering(board)) {
+                ponderer.start(board);
+            }
+            puts("Attacker is not ME, so I'm pondering for a while.");
             usleep(500*1000);
             continue;
         }
 
-        Move best_move = board.find_best_move();
+        ponderer.stop();
+        Move best_move;
+        if (ponderer.predicted_reply(board, best_move)) {
+            puts("The opponent made the move I expected, and I've already found my reply.");
+        } else if (!board.find_best_move(best_move, board_still_shown)) {
+            puts("The board changed while I was thinking about it.");
+            continue;
+        }
         std::string key = board.str();
         if (!seen_it.insert(key).second) {
             /* The key has already been seen in this game! */
@@ -135,10 +179,14 @@ int main(int argc, char **argv)
         printf("Second click at (%d,%d)\n", x,y);
 
         single_click_at(x,y);
-        usleep(2500*1000);  /* Let the UI catch up to this click. */
 
         board.apply_move(best_move);
         expecting_to_win = (board.score() == +9999);
+        if (!expecting_to_win) {
+            /* Think about the opponent's move while we wait. */
+            ponderer.start(board);
+        }
+        usleep(2500*1000);  /* Let the UI catch up to this click. */
     }  /* while */
     return 0;
 }
@@ -293,7 +293,6 @@ Board process_image(unsigned char (*im)[3], int w, int h)
     } else if (black_found != 6) {
         throw "Found fewer than 6 black pieces";
     }
-    board.update_scaredness();
     if (!found_attacker) {
         /* This happens when pieces are in transit, or at the end of the game. */
         if (board_has_crowns(im,w,h, board)) {
@@ -302,6 +301,7 @@ Board process_image(unsigned char (*im)[3], int w, int h)
             throw "Neither side seems to be the attacker yet";
         }
     }
+    board.pieces_changed();
 
     if (found_red_circle) {
         throw opponent_is_thinking();